@@ -0,0 +1,9 @@
+#
+# Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+set(LibPicotcp ON CACHE BOOL "" FORCE)
+set(LibPicotcpBsd OFF CACHE BOOL "" FORCE)
+set(CAmkESNoFPUByDefault ON CACHE BOOL "" FORCE)
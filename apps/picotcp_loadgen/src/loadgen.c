@@ -0,0 +1,440 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <camkes.h>
+
+#undef PACKED
+#include <pico_stack.h>
+#include <pico_socket.h>
+#include <pico_ipv4.h>
+#include <pico_device.h>
+
+#include <ports.h>
+#include <tuning_params.h>
+
+#include "loopback.h"
+
+/* This file implements a load generator for the TCP and UDP echo servers.
+ *
+ * The echo servers and the load generator share one picotcp stack, which
+ * talks to itself through a loopback device. The generator opens
+ * `concurrency` connections to the echo port picked by `workload` and sends
+ * `message_size` byte messages over them for `duration_ms` milliseconds.
+ *
+ * With `rate` set to 0 the load is closed loop: every connection has one
+ * message in flight and sends the next one as soon as the echo of the previous
+ * one is back. Otherwise the load is open loop: `rate` messages per second are
+ * spread over the connections regardless of how many are still in flight.
+ *
+ * Once the connections are up the component busy polls the stack until the
+ * run is over, and then prints the throughput and a latency histogram. The
+ * latencies are in nanoseconds from the TimeServer, so they include the cost
+ * of the timer calls made around each message.
+ */
+
+/* Address of the loopback device */
+#define LOADGEN_ADDR "10.0.0.1"
+#define LOADGEN_NETMASK "255.0.0.0"
+
+#define MAX_CONNS 256
+/* Messages that can be in flight on a connection, must be a power of two */
+#define MAX_OUTSTANDING 64
+#define MAX_MESSAGE_SIZE 0x4000
+
+#define CONNECT_TIMEOUT_MS 5000
+/* How long to wait for messages still in flight at the end of the run */
+#define DRAIN_TIMEOUT_MS 1000
+
+/* Latency histogram with HIST_SUB buckets for every power of two */
+#define HIST_SUB_BITS 4
+#define HIST_SUB BIT(HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct lg_conn {
+    struct pico_socket *socket;
+    bool connected;
+    /* Bytes of the message being sent that picotcp hasn't taken yet */
+    uint32_t tx_remaining;
+    /* Bytes received of the echo currently arriving */
+    uint32_t rx_received;
+    /* Send times of messages in flight, in ns. Free running indices, messages
+     * are added at head and completed from tail. */
+    uint64_t sent_at[MAX_OUTSTANDING];
+    uint32_t sent_head;
+    uint32_t sent_tail;
+} lg_conn_t;
+
+typedef enum {
+    LG_CONNECTING,
+    LG_RUNNING,
+    LG_DRAINING,
+    LG_DONE,
+} lg_state_t;
+
+static lg_state_t state = LG_CONNECTING;
+static bool use_udp;
+static struct pico_ip4 echo_addr;
+
+static lg_conn_t conns[MAX_CONNS];
+static int num_connected;
+/* Next connection to try for an open loop send */
+static int next_conn;
+
+static char tx_buf[MAX_MESSAGE_SIZE];
+static char rx_buf[MAX_MESSAGE_SIZE];
+
+static uint64_t start_ms;
+static uint64_t run_start_ms;
+static uint64_t drain_start_ms;
+
+/* Messages sent or due to be sent in open loop mode */
+static uint64_t issued;
+/* Open loop sends skipped because every connection had MAX_OUTSTANDING in flight */
+static uint64_t missed;
+static uint64_t completed;
+
+/* Snapshot taken when the measured run ends */
+static uint64_t run_ms;
+static uint64_t run_completed;
+
+static uint64_t hist[HIST_BUCKETS];
+static uint64_t hist_count;
+static uint64_t hist_max;
+
+static int hist_bucket(uint64_t value)
+{
+    if (value < HIST_SUB) {
+        return value;
+    }
+    int exp = 63 - __builtin_clzll(value);
+    return (exp - HIST_SUB_BITS + 1) * HIST_SUB + ((value >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Smallest value that falls into bucket */
+static uint64_t hist_bucket_low(int bucket)
+{
+    if (bucket < HIST_SUB) {
+        return bucket;
+    }
+    int exp = bucket / HIST_SUB + HIST_SUB_BITS - 1;
+    return (uint64_t)(HIST_SUB + bucket % HIST_SUB) << (exp - HIST_SUB_BITS);
+}
+
+static void hist_add(uint64_t value)
+{
+    hist[hist_bucket(value)]++;
+    hist_count++;
+    hist_max = MAX(hist_max, value);
+}
+
+/* Value below which ppm parts per million of the samples fall */
+static uint64_t hist_percentile(uint64_t ppm)
+{
+    uint64_t target = (hist_count * ppm + 999999) / 1000000;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= target && seen > 0) {
+            return hist_bucket_low(i);
+        }
+    }
+    return hist_max;
+}
+
+/* Give picotcp as much of the current message as it will take */
+static void lg_flush(lg_conn_t *conn)
+{
+    while (conn->tx_remaining > 0) {
+        int ret;
+        if (use_udp) {
+            ret = pico_socket_sendto(conn->socket, tx_buf, message_size, &echo_addr, short_be(UDP_ECHO_PORT));
+        } else {
+            ret = pico_socket_send(conn->socket, tx_buf + message_size - conn->tx_remaining, conn->tx_remaining);
+        }
+        if (ret == -1) {
+            ZF_LOGE("pico_socket_send: error received: %d", pico_err);
+            break;
+        }
+        if (ret == 0) {
+            /* Retry on the write event */
+            break;
+        }
+        conn->tx_remaining -= use_udp ? message_size : ret;
+    }
+}
+
+static bool lg_can_send(lg_conn_t *conn)
+{
+    return conn->connected && conn->tx_remaining == 0 && conn->sent_head - conn->sent_tail < MAX_OUTSTANDING;
+}
+
+static void lg_send(lg_conn_t *conn)
+{
+    conn->sent_at[conn->sent_head % MAX_OUTSTANDING] = timeout_time();
+    conn->sent_head++;
+    conn->tx_remaining = message_size;
+    lg_flush(conn);
+}
+
+static void lg_complete(lg_conn_t *conn)
+{
+    if (conn->sent_head == conn->sent_tail) {
+        ZF_LOGE("Received an echo that was never sent");
+        return;
+    }
+    uint64_t sent_at = conn->sent_at[conn->sent_tail % MAX_OUTSTANDING];
+    conn->sent_tail++;
+    if (state != LG_RUNNING) {
+        return;
+    }
+    hist_add(timeout_time() - sent_at);
+    completed++;
+    if (rate == 0) {
+        lg_send(conn);
+    }
+}
+
+static void lg_recv(lg_conn_t *conn)
+{
+    while (true) {
+        int ret;
+        if (use_udp) {
+            uint32_t orig;
+            uint16_t remote_port;
+            ret = pico_socket_recvfrom(conn->socket, rx_buf, sizeof(rx_buf), &orig, &remote_port);
+        } else {
+            ret = pico_socket_recv(conn->socket, rx_buf, sizeof(rx_buf));
+        }
+        if (ret == -1) {
+            ZF_LOGE("pico_socket_recv: error received: %d", pico_err);
+            return;
+        } else if (ret == 0) {
+            return;
+        }
+        if (use_udp) {
+            lg_complete(conn);
+            continue;
+        }
+        /* TCP echoes come back as a byte stream, so count whole messages */
+        conn->rx_received += ret;
+        while (conn->rx_received >= message_size) {
+            conn->rx_received -= message_size;
+            lg_complete(conn);
+        }
+    }
+}
+
+static void handle_loadgen_notification(uint16_t events, struct pico_socket *s)
+{
+    lg_conn_t *conn = s->priv;
+
+    if (events & PICO_SOCK_EV_CONN) {
+        conn->connected = true;
+        num_connected++;
+    }
+    if (events & PICO_SOCK_EV_RD) {
+        lg_recv(conn);
+    }
+    if (events & PICO_SOCK_EV_WR) {
+        lg_flush(conn);
+    }
+    if (events & PICO_SOCK_EV_CLOSE) {
+        pico_socket_shutdown(s, PICO_SHUT_RDWR);
+    }
+    if (events & PICO_SOCK_EV_FIN) {
+        conn->connected = false;
+        conn->socket = NULL;
+    }
+    if (events & PICO_SOCK_EV_ERR) {
+        ZF_LOGE("Error with socket %p: %d", s, pico_err);
+    }
+}
+
+/* Issue the open loop sends that have fallen due */
+static void lg_open_loop_send(uint64_t now_ms)
+{
+    uint64_t due = (now_ms - run_start_ms) * rate / 1000;
+    while (issued < due) {
+        issued++;
+        int i;
+        for (i = 0; i < concurrency && !lg_can_send(&conns[next_conn]); i++) {
+            next_conn = (next_conn + 1) % concurrency;
+        }
+        if (i == concurrency) {
+            missed++;
+            continue;
+        }
+        lg_send(&conns[next_conn]);
+        next_conn = (next_conn + 1) % concurrency;
+    }
+}
+
+static bool lg_in_flight(void)
+{
+    for (int i = 0; i < concurrency; i++) {
+        if (conns[i].sent_head != conns[i].sent_tail) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void lg_report(void)
+{
+    const char *loop = rate == 0 ? "closed loop" : "open loop";
+    printf("%s: %s, %d byte messages, %d connections, %s", get_instance_name(), use_udp ? "udp" : "tcp",
+           message_size, concurrency, loop);
+    if (rate != 0) {
+        printf(" at %d msg/s, %"PRIu64" sends missed", rate, missed);
+    }
+    printf("\n");
+    if (run_ms == 0 || hist_count == 0) {
+        printf("%s: no messages completed\n", get_instance_name());
+        return;
+    }
+    printf("%s: %"PRIu64" messages in %"PRIu64" ms, %"PRIu64" msg/s, %"PRIu64" KiB/s\n", get_instance_name(),
+           run_completed, run_ms, run_completed * 1000 / run_ms,
+           run_completed * message_size * 1000 / run_ms / 1024);
+
+    uint64_t p50 = hist_percentile(500000);
+    uint64_t p99 = hist_percentile(990000);
+    uint64_t p999 = hist_percentile(999000);
+    printf("%s: latency ns p50 %"PRIu64" p99 %"PRIu64" p999 %"PRIu64" max %"PRIu64"\n", get_instance_name(),
+           p50, p99, p999, hist_max);
+}
+
+/* Move the run along after each pass of the stack */
+static void lg_step(void)
+{
+    uint64_t now_ms = PICO_TIME_MS();
+    switch (state) {
+    case LG_CONNECTING:
+        if (num_connected == concurrency) {
+            state = LG_RUNNING;
+            run_start_ms = now_ms;
+            if (rate == 0) {
+                for (int i = 0; i < concurrency; i++) {
+                    lg_send(&conns[i]);
+                }
+            }
+        } else if (now_ms - start_ms > CONNECT_TIMEOUT_MS) {
+            ZF_LOGE("Only %d of %d connections came up", num_connected, concurrency);
+            state = LG_DONE;
+        }
+        break;
+    case LG_RUNNING:
+        if (rate != 0) {
+            lg_open_loop_send(now_ms);
+        }
+        if (now_ms - run_start_ms >= duration_ms) {
+            run_ms = now_ms - run_start_ms;
+            run_completed = completed;
+            drain_start_ms = now_ms;
+            state = LG_DRAINING;
+        }
+        break;
+    case LG_DRAINING:
+        if (!lg_in_flight() || now_ms - drain_start_ms > DRAIN_TIMEOUT_MS) {
+            state = LG_DONE;
+        }
+        break;
+    case LG_DONE:
+        break;
+    }
+}
+
+static void tick_on_event(UNUSED seL4_Word badge, UNUSED void *cookie)
+{
+    if (state == LG_DONE) {
+        pico_stack_tick();
+        return;
+    }
+    /* Take over the CPU until the run is over */
+    start_ms = PICO_TIME_MS();
+    while (state != LG_DONE) {
+        pico_stack_tick();
+        lg_step();
+    }
+    lg_report();
+    for (int i = 0; i < concurrency; i++) {
+        if (conns[i].socket != NULL) {
+            pico_socket_close(conns[i].socket);
+        }
+    }
+    printf("%s: done\n", get_instance_name());
+}
+
+int setup_loadgen(UNUSED ps_io_ops_t *io_ops)
+{
+    use_udp = strcmp(workload, "udp") == 0;
+    if (!use_udp && strcmp(workload, "tcp") != 0) {
+        ZF_LOGE("workload must be \"tcp\" or \"udp\", got \"%s\"", workload);
+        return -1;
+    }
+    if (concurrency <= 0 || concurrency > MAX_CONNS) {
+        ZF_LOGE("concurrency must be between 1 and %d", MAX_CONNS);
+        return -1;
+    }
+    int max_size = use_udp ? UDP_READ_SIZE : MAX_MESSAGE_SIZE;
+    if (message_size <= 0 || message_size > max_size) {
+        ZF_LOGE("message_size must be between 1 and %d", max_size);
+        return -1;
+    }
+
+    for (int i = 0; i < message_size; i++) {
+        tx_buf[i] = i;
+    }
+
+    struct pico_device *dev = loopback_create("loop0", ETH_MTU);
+    if (dev == NULL) {
+        return -1;
+    }
+    struct pico_ip4 netmask;
+    pico_string_to_ipv4(LOADGEN_ADDR, &echo_addr.addr);
+    pico_string_to_ipv4(LOADGEN_NETMASK, &netmask.addr);
+    if (pico_ipv4_link_add(dev, echo_addr, netmask) != 0) {
+        ZF_LOGE("Failed to add address to loopback device: %d", pico_err);
+        return -1;
+    }
+
+    /* Connections are made now and complete once the stack starts ticking,
+     * by which time the echo servers are listening. */
+    uint16_t proto = use_udp ? PICO_PROTO_UDP : PICO_PROTO_TCP;
+    for (int i = 0; i < concurrency; i++) {
+        lg_conn_t *conn = &conns[i];
+        conn->socket = pico_socket_open(PICO_PROTO_IPV4, proto, handle_loadgen_notification);
+        if (conn->socket == NULL) {
+            ZF_LOGE("Failed to open socket %d: %d", i, pico_err);
+            return -1;
+        }
+        conn->socket->priv = conn;
+        int ret;
+        if (use_udp) {
+            struct pico_ip4 local_addr = echo_addr;
+            uint16_t local_port = 0;
+            ret = pico_socket_bind(conn->socket, &local_addr, &local_port);
+            conn->connected = true;
+            num_connected++;
+        } else {
+            ret = pico_socket_connect(conn->socket, &echo_addr, short_be(TCP_ECHO_PORT));
+        }
+        if (ret) {
+            ZF_LOGE("Failed to set up socket %d: %d", i, pico_err);
+            return -1;
+        }
+    }
+
+    single_threaded_component_register_handler(0, "pico_stack_tick", tick_on_event, NULL);
+
+    return 0;
+}
+
+CAMKES_POST_INIT_MODULE_DEFINE(setup_loadgen_, setup_loadgen);
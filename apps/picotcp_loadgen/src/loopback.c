@@ -0,0 +1,81 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <string.h>
+
+#include <camkes.h>
+
+#undef PACKED
+#include <pico_stack.h>
+#include <pico_device.h>
+
+#include <tuning_params.h>
+
+#include "loopback.h"
+
+/* Packets queued between being sent and being handed back to the stack */
+#define LOOPBACK_FRAMES 256
+
+typedef struct loopback_frame {
+    int len;
+    uint8_t data[ETH_MTU];
+} loopback_frame_t;
+
+static struct pico_device loop_dev;
+
+/* Free running indices, packets are queued at head and delivered from tail */
+static loopback_frame_t frames[LOOPBACK_FRAMES];
+static uint32_t frames_head;
+static uint32_t frames_tail;
+
+static int loopback_send(UNUSED struct pico_device *dev, void *buf, int len)
+{
+    if (len > ETH_MTU) {
+        ZF_LOGE("Dropping %d byte packet larger than the MTU", len);
+        return len;
+    }
+    if (frames_head - frames_tail == LOOPBACK_FRAMES) {
+        /* Queue full, picotcp will try again later */
+        return 0;
+    }
+    loopback_frame_t *frame = &frames[frames_head % LOOPBACK_FRAMES];
+    memcpy(frame->data, buf, len);
+    frame->len = len;
+    frames_head++;
+    return len;
+}
+
+static int loopback_poll(struct pico_device *dev, int loop_score)
+{
+    while (loop_score > 0 && frames_tail != frames_head) {
+        loopback_frame_t *frame = &frames[frames_tail % LOOPBACK_FRAMES];
+        /* picotcp copies the packet */
+        pico_stack_recv(dev, frame->data, frame->len);
+        frames_tail++;
+        loop_score--;
+    }
+    return loop_score;
+}
+
+struct pico_device *loopback_create(const char *name, uint32_t mtu)
+{
+    if (mtu > ETH_MTU) {
+        ZF_LOGE("mtu %u is larger than the ETH_MTU (%d) frames were sized for", mtu, ETH_MTU);
+        return NULL;
+    }
+    loop_dev.send = loopback_send;
+    loop_dev.poll = loopback_poll;
+    loop_dev.mtu = mtu;
+    /* Without a MAC address picotcp sends and receives bare IP packets */
+    if (pico_device_init(&loop_dev, name, NULL) != 0) {
+        ZF_LOGE("Failed to initialize pico device");
+        return NULL;
+    }
+    loop_dev.q_in->max_frames = LOOPBACK_FRAMES;
+    loop_dev.q_out->max_frames = LOOPBACK_FRAMES;
+    return &loop_dev;
+}
@@ -0,0 +1,21 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <pico_device.h>
+
+/**
+ * Create a picotcp device that hands every packet sent on it back to the
+ * stack. Packets are queued when sent and delivered the next time picotcp
+ * polls the device.
+ *
+ * @param name  Name of the device
+ * @param mtu   Largest IP packet the device takes
+ *
+ * @return the device, or NULL on failure
+ */
+struct pico_device *loopback_create(const char *name, uint32_t mtu);
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Batch size histograms have power of two buckets:
+ * 0, 1, 2-3, 4-7, ..., 128 and above */
+#define ETH_STATS_HIST_BUCKETS 9
+
+/* Counters for the ethernet datapath. They are only ever updated by the
+ * component's single thread and can be read at any time. */
+typedef struct eth_stats {
+    /* Frames and bytes queued for a client */
+    uint64_t rx_frames;
+    uint64_t rx_bytes;
+    /* Frames the driver scattered over more than one buffer */
+    uint64_t rx_multi_buf_frames;
+    /* Times the driver asked for an RX buffer and the pool was empty */
+    uint64_t rx_pool_empty;
+    /* Frames dropped because the client's pending queue was full */
+    uint64_t rx_dropped_queue_full;
+    /* Frames dropped because they were larger than RX_FRAME_MAX */
+    uint64_t rx_dropped_oversize;
+    /* Lowest number of free buffers seen in the RX pool */
+    uint64_t rx_pool_min_free;
+    /* RX buffers currently held by picotcp in zero copy mode, and the peak */
+    uint64_t rx_bufs_in_stack;
+    uint64_t rx_bufs_in_stack_max;
+    /* Times pico_eth_poll used up its loop score with frames still pending */
+    uint64_t rx_loop_score_exhausted;
+
+    /* Frames and bytes given to the driver */
+    uint64_t tx_frames;
+    uint64_t tx_bytes;
+    /* Times pico_eth_send was refused because no TX buffer was free */
+    uint64_t tx_pool_empty;
+    /* Times the driver couldn't take a frame because its ring was full */
+    uint64_t tx_ring_full;
+
+    /* Times the component switched from interrupts to polling */
+    uint64_t poll_mode_entries;
+
+    /* Frames received and sent per stack tick */
+    uint64_t rx_batch_hist[ETH_STATS_HIST_BUCKETS];
+    uint64_t tx_batch_hist[ETH_STATS_HIST_BUCKETS];
+} eth_stats_t;
+
+extern eth_stats_t eth_stats;
+
+/**
+ * Print the counters as "name,value" lines.
+ *
+ * @return number of characters written, as for snprintf
+ */
+int eth_stats_print(char *buf, size_t len);
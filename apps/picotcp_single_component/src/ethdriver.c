@@ -6,6 +6,7 @@
 
 #include <autoconf.h>
 #include <stdbool.h>
+#include <stdlib.h>
 
 #include <camkes.h>
 #include <camkes/dma.h>
@@ -25,11 +26,22 @@
 #include <pico_dhcp_client.h>
 #include <pico_device.h>
 
-#include "tuning_params.h"
+#include <ports.h>
+#include <spsc_ring.h>
+#include <tuning_params.h>
+
+#include "eth_stats.h"
+#include "rx_classifier.h"
+
+static_assert(ETH_RING_SLOTS >= RX_BUFS && ETH_RING_SLOTS >= TX_BUFS,
+              "ETH_RING_SLOTS must be able to hold every buffer");
 
 
 struct eth_driver *eth_driver;
 
+/* DMA manager used for cache maintenance on the TX buffers */
+static ps_dma_man_t *dma_manager;
+
 struct pico_device pico_dev;
 
 /*
@@ -41,46 +53,168 @@ typedef struct eth_buf {
     char *buf;
     uintptr_t phys;
     size_t len;
+    /* whether buf is mapped cached and needs cleaning before DMA */
+    bool cached;
+    /* next buffer of the same frame if the driver scattered it over several */
+    struct eth_buf *next;
 } eth_buf_t;
 
 eth_buf_t rx_bufs[RX_BUFS];
 eth_buf_t tx_bufs[TX_BUFS];
 
-/* keeps track of the head of the queue */
-int pending_rx_head;
-/* keeps track of the tail of the queue */
-int pending_rx_tail;
+/*
+ * The RX and TX buffers are each carved out of a single physically contiguous
+ * DMA allocation, so translating between virtual and physical addresses or
+ * from a buffer address back to its eth_buf_t is just arithmetic. This also
+ * keeps the working set on as few pages as possible. If the DMA pool can't
+ * provide a contiguous arena the buffers are allocated one at a time instead,
+ * and the arena's vaddr is left NULL.
+ */
+typedef struct dma_arena {
+    char *vaddr;
+    uintptr_t paddr;
+    size_t size;
+    bool cached;
+} dma_arena_t;
+
+static dma_arena_t rx_arena;
+static dma_arena_t tx_arena;
+
+static int dma_arena_alloc(ps_dma_man_t *dma, dma_arena_t *arena, size_t size, bool cached)
+{
+    arena->vaddr = ps_dma_alloc(dma, size, PAGE_SIZE_4K, cached, PS_MEM_NORMAL);
+    if (!arena->vaddr) {
+        return -1;
+    }
+    memset(arena->vaddr, 0, size);
+    arena->paddr = ps_dma_pin(dma, arena->vaddr, size);
+    if (!arena->paddr) {
+        ZF_LOGE("ps_dma_pin: Failed to return physical address.");
+        ps_dma_free(dma, arena->vaddr, size);
+        return -1;
+    }
+    /* Make sure the allocation really is physically contiguous */
+    for (size_t off = PAGE_SIZE_4K; off < size; off += PAGE_SIZE_4K) {
+        if (ps_dma_pin(dma, arena->vaddr + off, PAGE_SIZE_4K) != arena->paddr + off) {
+            ZF_LOGE("DMA allocation of %zu bytes is not physically contiguous", size);
+            ps_dma_unpin(dma, arena->vaddr, size);
+            ps_dma_free(dma, arena->vaddr, size);
+            return -1;
+        }
+    }
+    arena->size = size;
+    arena->cached = cached;
+    return 0;
+}
+
+static inline uintptr_t dma_arena_paddr(dma_arena_t *arena, void *vaddr)
+{
+    return arena->paddr + ((char *)vaddr - arena->vaddr);
+}
+
+/* RX buffers sorted by address, to find a buffer's eth_buf_t when they were
+ * allocated one at a time */
+static eth_buf_t *rx_bufs_sorted[RX_BUFS];
+
+static int eth_buf_compare(const void *a, const void *b)
+{
+    uintptr_t buf_a = (uintptr_t)(*(eth_buf_t *const *)a)->buf;
+    uintptr_t buf_b = (uintptr_t)(*(eth_buf_t *const *)b)->buf;
+    return (buf_a > buf_b) - (buf_a < buf_b);
+}
 
 /*
- * this is a cyclic queue of RX buffers pending to be read by a client,
- * the head represents the first buffer in the queue, and the tail the last
+ * Give each of bufs a BUF_SIZE buffer, carved out of one arena if possible.
+ * Otherwise each buffer gets its own allocation. With prefer_cached, cached
+ * memory is used where the DMA pool can provide it and uncached otherwise.
  */
-eth_buf_t *pending_rx[RX_BUFS];
+static int eth_bufs_alloc(ps_dma_man_t *dma, dma_arena_t *arena, eth_buf_t *bufs, int num_bufs,
+                          bool prefer_cached)
+{
+    size_t size = num_bufs * BUF_SIZE;
+    if ((prefer_cached && dma_arena_alloc(dma, arena, size, true) == 0) ||
+        dma_arena_alloc(dma, arena, size, false) == 0) {
+        for (int i = 0; i < num_bufs; i++) {
+            bufs[i].buf = arena->vaddr + i * BUF_SIZE;
+            bufs[i].phys = dma_arena_paddr(arena, bufs[i].buf);
+            bufs[i].cached = arena->cached;
+        }
+        return 0;
+    }
+    ZF_LOGW("Falling back to allocating %d DMA buffers one at a time", num_bufs);
+    arena->vaddr = NULL;
+    for (int i = 0; i < num_bufs; i++) {
+        bufs[i].cached = prefer_cached;
+        bufs[i].buf = prefer_cached ? ps_dma_alloc(dma, BUF_SIZE, 64, 1, PS_MEM_NORMAL) : NULL;
+        if (!bufs[i].buf) {
+            bufs[i].cached = false;
+            bufs[i].buf = ps_dma_alloc(dma, BUF_SIZE, 64, 0, PS_MEM_NORMAL);
+        }
+        if (!bufs[i].buf) {
+            return -1;
+        }
+        memset(bufs[i].buf, 0, BUF_SIZE);
+        bufs[i].phys = ps_dma_pin(dma, bufs[i].buf, BUF_SIZE);
+        if (!bufs[i].phys) {
+            ZF_LOGE("ps_dma_pin: Failed to return physical address.");
+            return -1;
+        }
+    }
+    return 0;
+}
 
-/* keeps track of how many TX buffers are in use */
-int num_tx;
 /*
- * this represents the pool of buffers that can be used for TX,
- * this array is a sliding array in that num_tx acts a pointer to
- * separate between buffers that are in use and buffers that are
- * not in use. E.g. 'o' = free, 'x' = in use
- *  -------------------------------------
- *  | o | o | o | o | o | o | x | x | x |
- *  -------------------------------------
- *                          ^
- *                        num_tx
+ * A consumer of received frames. Every client has its own queue of RX frames
+ * pending to be read, which the classifier in eth_rx_complete fills.
+ * Each entry is the first buffer of a frame, further buffers of the same
+ * frame are chained through eth_buf_t.next.
  */
-eth_buf_t *tx_buf_pool[TX_BUFS];
+typedef struct eth_rx_client {
+    /* picotcp device that reads from this client's queue */
+    struct pico_device *dev;
+    spsc_ring_t *pending_rx;
+} eth_rx_client_t;
+
+static char pending_rx_storage[NUM_RX_CLIENTS][SPSC_RING_BYTES(ETH_RING_SLOTS)] ALIGN(SPSC_RING_CACHE_LINE);
+static eth_rx_client_t rx_clients[NUM_RX_CLIENTS];
+
+/* The picotcp stack in this component is always client 0 */
+#define PICO_RX_CLIENT 0
+
+eth_stats_t eth_stats = {
+    .rx_pool_min_free = RX_BUFS,
+};
+
+/* Values of eth_stats.rx_frames and tx_frames when the previous stack tick ran */
+static uint64_t rx_frames_last_tick;
+static uint64_t tx_frames_last_tick;
+
+/* Used to linearize frames that were received into multiple buffers */
+static char rx_linear_buf[RX_FRAME_MAX];
+
+/* Buffers that are free to be used for TX */
+SPSC_RING_DEFINE(tx_buf_pool, ETH_RING_SLOTS);
+
+/* Buffers that are free to be given to the driver for RX */
+SPSC_RING_DEFINE(rx_buf_pool, ETH_RING_SLOTS);
 
+/* Completed TX buffers waiting to be returned to tx_buf_pool */
+static uintptr_t tx_reclaim[TX_RECLAIM_BATCH];
+static int tx_reclaim_len;
 
-static int num_rx_bufs;
-static eth_buf_t *rx_buf_pool[RX_BUFS];
+static void eth_tx_reclaim(void)
+{
+    spsc_ring_enqueue_burst(tx_buf_pool, tx_reclaim, tx_reclaim_len);
+    tx_reclaim_len = 0;
+}
 
 static void eth_tx_complete(void *iface, void *cookie)
 {
-    eth_buf_t *buf = (eth_buf_t *)cookie;
-    tx_buf_pool[num_tx] = buf;
-    num_tx++;
+    tx_reclaim[tx_reclaim_len] = (uintptr_t)cookie;
+    tx_reclaim_len++;
+    if (tx_reclaim_len == TX_RECLAIM_BATCH) {
+        eth_tx_reclaim();
+    }
 }
 
 static uintptr_t eth_allocate_rx_buf(void *iface, size_t buf_size, void **cookie)
@@ -88,37 +222,99 @@ static uintptr_t eth_allocate_rx_buf(void *iface, size_t buf_size, void **cookie
     if (buf_size > BUF_SIZE) {
         return 0;
     }
-    if (num_rx_bufs == 0) {
+    uintptr_t buf;
+    if (!spsc_ring_dequeue(rx_buf_pool, &buf)) {
+        if (eth_stats.rx_pool_empty == 0) {
+            ZF_LOGW("RX buffer pool exhausted, consider increasing RX_BUFS");
+        }
+        eth_stats.rx_pool_empty++;
         return 0;
     }
-    num_rx_bufs--;
-    *cookie = rx_buf_pool[num_rx_bufs];
-    return rx_buf_pool[num_rx_bufs]->phys;
+    uint32_t num_free = spsc_ring_count(rx_buf_pool);
+    if (num_free < eth_stats.rx_pool_min_free) {
+        eth_stats.rx_pool_min_free = num_free;
+    }
+    *cookie = (void *)buf;
+    return ((eth_buf_t *)buf)->phys;
 }
 
 
+static void return_rx_bufs(unsigned int num_bufs, void **cookies)
+{
+    spsc_ring_enqueue_burst(rx_buf_pool, (uintptr_t *)cookies, num_bufs);
+}
+
 static void eth_rx_complete(void *iface, unsigned int num_bufs, void **cookies, unsigned int *lens)
 {
-    /* insert filtering here. currently everything just goes to one client */
-    if (num_bufs != 1) {
+    if (num_bufs == 0) {
+        return;
+    }
+#if NUM_RX_CLIENTS > 1
+    /* The headers used for classification are always in the first buffer */
+    eth_buf_t *first_buf = cookies[0];
+    int client = rx_classifier_classify((uint8_t *)first_buf->buf, lens[0]);
+    if (client < 0 || client >= NUM_RX_CLIENTS) {
+        client = PICO_RX_CLIENT;
+    }
+#else
+    /* With a single client there is nothing to classify */
+    int client = PICO_RX_CLIENT;
+#endif
+    spsc_ring_t *pending_rx = rx_clients[client].pending_rx;
+    if (spsc_ring_full(pending_rx)) {
+        eth_stats.rx_dropped_queue_full++;
         goto error;
     }
-    eth_buf_t *curr_buf = cookies[0];
-    if (((pending_rx_head + 1) % RX_BUFS) == pending_rx_tail) {
+    /* All buffers handed over in one completion belong to the same frame,
+     * chain them together so that they are consumed as one entry. */
+    size_t frame_len = 0;
+    for (int i = 0; i < num_bufs; i++) {
+        eth_buf_t *curr_buf = cookies[i];
+        curr_buf->len = lens[i];
+        curr_buf->next = (i + 1 < num_bufs) ? cookies[i + 1] : NULL;
+        frame_len += lens[i];
+    }
+    if (frame_len > RX_FRAME_MAX) {
+        eth_stats.rx_dropped_oversize++;
         goto error;
     }
-    curr_buf->len = lens[0];
-    pending_rx[pending_rx_head] = curr_buf;
-    pending_rx_head = (pending_rx_head + 1) % RX_BUFS;
+    spsc_ring_enqueue(pending_rx, (uintptr_t)cookies[0]);
+    eth_stats.rx_frames++;
+    eth_stats.rx_bytes += frame_len;
+    if (num_bufs > 1) {
+        eth_stats.rx_multi_buf_frames++;
+    }
     return;
 error:
     /* abort and put all the bufs back */
-    for (int i = 0; i < num_bufs; i++) {
-        eth_buf_t *returned_buf = cookies[i];
-        rx_buf_pool[num_rx_bufs] = returned_buf;
-        num_rx_bufs++;
+    return_rx_bufs(num_bufs, cookies);
+}
+
+#if RX_ZERO_COPY
+/*
+ * Called by picotcp once it has finished with a frame that was handed over
+ * with pico_stack_recv_zerocopy_ext_buffer_notify.
+ */
+static void eth_rx_buf_release(uint8_t *frame)
+{
+    eth_buf_t *rx;
+    if (rx_arena.vaddr) {
+        rx = &rx_bufs[((char *)frame - rx_arena.vaddr) / BUF_SIZE];
+    } else {
+        eth_buf_t key = { .buf = (char *)frame };
+        eth_buf_t *key_ptr = &key;
+        eth_buf_t **found = bsearch(&key_ptr, rx_bufs_sorted, RX_BUFS, sizeof(rx_bufs_sorted[0]),
+                                    eth_buf_compare);
+        if (!found) {
+            ZF_LOGE("Released frame %p is not an RX buffer", frame);
+            return;
+        }
+        rx = *found;
     }
+    spsc_ring_enqueue(rx_buf_pool, (uintptr_t)rx);
+    eth_stats.rx_bufs_in_stack--;
 }
+#endif
 
 static struct raw_iface_callbacks ethdriver_callbacks = {
     .tx_complete = eth_tx_complete,
@@ -130,23 +326,73 @@ static struct raw_iface_callbacks ethdriver_callbacks = {
 /* Async driver will set a flag to signal that there is work to be done  */
 static int pico_eth_poll(struct pico_device *dev, int loop_score)
 {
+#if NUM_RX_CLIENTS > 1
+    spsc_ring_t *pending_rx = NULL;
+    for (int i = 0; i < NUM_RX_CLIENTS; i++) {
+        if (rx_clients[i].dev == dev) {
+            pending_rx = rx_clients[i].pending_rx;
+            break;
+        }
+    }
+    assert(pending_rx != NULL);
+#else
+    spsc_ring_t *pending_rx = rx_clients[PICO_RX_CLIENT].pending_rx;
+#endif
     while (loop_score > 0) {
         int err;
-        if (pending_rx_head == pending_rx_tail) {
+        uintptr_t entry;
+        if (!spsc_ring_peek(pending_rx, &entry)) {
             break;
         }
-        eth_buf_t *rx = pending_rx[pending_rx_tail];
-        err = pico_stack_recv(dev, (void *)rx->buf, rx->len);
+        eth_buf_t *rx = (eth_buf_t *)entry;
+#if RX_ZERO_COPY
+        if (rx->next == NULL) {
+            /* Don't hand over a buffer that picotcp would immediately discard */
+            if (dev->q_in->frames >= dev->q_in->max_frames) {
+                break;
+            }
+            /* picotcp now owns the buffer until eth_rx_buf_release is called.
+             * The input queue has room, so a negative return means picotcp
+             * couldn't allocate the frame and never took the buffer. */
+            spsc_ring_dequeue(pending_rx, &entry);
+            eth_stats.rx_bufs_in_stack++;
+            if (eth_stats.rx_bufs_in_stack > eth_stats.rx_bufs_in_stack_max) {
+                eth_stats.rx_bufs_in_stack_max = eth_stats.rx_bufs_in_stack;
+            }
+            if (pico_stack_recv_zerocopy_ext_buffer_notify(dev, (uint8_t *)rx->buf, rx->len,
+                                                           eth_rx_buf_release) < 0) {
+                eth_rx_buf_release((uint8_t *)rx->buf);
+                break;
+            }
+            loop_score--;
+            continue;
+        }
+#endif
+        if (rx->next == NULL) {
+            err = pico_stack_recv(dev, (void *)rx->buf, rx->len);
+        } else {
+            /* picotcp wants a contiguous frame, copy the chain into one buffer */
+            size_t frame_len = 0;
+            for (eth_buf_t *curr = rx; curr != NULL; curr = curr->next) {
+                memcpy(rx_linear_buf + frame_len, curr->buf, curr->len);
+                frame_len += curr->len;
+            }
+            err = pico_stack_recv(dev, (void *)rx_linear_buf, frame_len);
+        }
         if (err <= 0) {
             break;
         } else {
-            pending_rx_tail = (pending_rx_tail + 1) % RX_BUFS;
-            rx_buf_pool[num_rx_bufs] = rx;
-            num_rx_bufs++;
+            spsc_ring_dequeue(pending_rx, &entry);
+            while (rx != NULL) {
+                eth_buf_t *next = rx->next;
+                spsc_ring_enqueue(rx_buf_pool, (uintptr_t)rx);
+                rx = next;
+            }
         }
         loop_score--;
     }
     if (loop_score == 0) {
+        eth_stats.rx_loop_score_exhausted++;
         ZF_LOGE("rx loop score died\n");
     }
 
@@ -160,38 +406,135 @@ static int pico_eth_send(struct pico_device *dev, void *input_buf, int len)
         ZF_LOGF("Len invalid\n");
     }
 
-    if (num_tx == 0) {
-        // No packets available
-        return 0; // Error for PICO
+    uintptr_t entry;
+    if (!spsc_ring_dequeue(tx_buf_pool, &entry)) {
+        eth_tx_reclaim();
+        if (!spsc_ring_dequeue(tx_buf_pool, &entry)) {
+            eth_stats.tx_pool_empty++;
+            // No packets available
+            return 0; // Error for PICO
+        }
     }
+    eth_buf_t *tx_buf = (eth_buf_t *)entry;
 
-    num_tx --;
-    eth_buf_t *tx_buf = tx_buf_pool[num_tx];
-
-    /* copy the packet over */
+    /* copy the packet over. picotcp owns the frame memory so this copy can't
+     * be avoided, but it is done into a cached mapping where possible and the
+     * cache lines are cleaned to memory before the device reads them. */
     memcpy(tx_buf->buf, input_buf, len);
+    if (tx_buf->cached) {
+        ps_dma_cache_clean(dma_manager, tx_buf->buf, len);
+    }
 
-    /* queue up transmit */
+    /* queue up transmit. Each raw_tx call is a single frame, libethdrivers has
+     * no way to hand over several frames with one tail update, so holding
+     * frames back to submit them together wouldn't save any doorbell writes. */
     int err = eth_driver->i_fn.raw_tx(eth_driver, 1, (uintptr_t *) & (tx_buf->phys),
                                       (unsigned int *)&len, tx_buf);
     switch (err) {
     case ETHIF_TX_FAILED:
-        tx_buf_pool[num_tx] = tx_buf;
-        num_tx++;
+        eth_stats.tx_ring_full++;
+        spsc_ring_enqueue(tx_buf_pool, (uintptr_t)tx_buf);
         return 0; // Error for PICO
     case ETHIF_TX_COMPLETE:
     case ETHIF_TX_ENQUEUED:
         break;
     }
+    eth_stats.tx_frames++;
+    eth_stats.tx_bytes += len;
     return len;
 }
 
+static int hist_bucket(uint64_t count)
+{
+    if (count == 0) {
+        return 0;
+    }
+    return MIN(ETH_STATS_HIST_BUCKETS - 1, 64 - __builtin_clzll(count));
+}
+
+/*
+ * Run the stack and return the completed TX buffers it freed up to the pool.
+ * Returns the number of frames received since the previous tick.
+ */
+static uint64_t eth_stack_tick(void)
+{
+    uint64_t rx_batch = eth_stats.rx_frames - rx_frames_last_tick;
+    rx_frames_last_tick = eth_stats.rx_frames;
+    pico_stack_tick();
+    eth_tx_reclaim();
+    uint64_t tx_batch = eth_stats.tx_frames - tx_frames_last_tick;
+    tx_frames_last_tick = eth_stats.tx_frames;
+    eth_stats.rx_batch_hist[hist_bucket(rx_batch)]++;
+    eth_stats.tx_batch_hist[hist_bucket(tx_batch)]++;
+    return rx_batch;
+}
+
+
 
 
+/*
+ * Busy poll the device instead of waiting for its interrupt. Polling stops
+ * once no frames have arrived for poll_mode_idle_rounds rounds in a row, after
+ * which the component goes back to waiting on the IRQ. Any interrupt raised
+ * while polling stays pending and is handled on return to the event loop.
+ */
+static void eth_busy_poll(void)
+{
+    int idle_rounds = 0;
+    eth_stats.poll_mode_entries++;
+    while (idle_rounds < poll_mode_idle_rounds) {
+        eth_driver->i_fn.raw_poll(eth_driver);
+        if (eth_stack_tick() == 0) {
+            idle_rounds++;
+        } else {
+            idle_rounds = 0;
+        }
+    }
+}
 
 static void tick_on_event(UNUSED seL4_Word badge, void *cookie)
 {
-    pico_stack_tick();
+    /* Switch to polling if this event delivered a large batch of frames */
+    uint64_t batch = eth_stack_tick();
+    if (poll_mode_threshold > 0 && batch >= poll_mode_threshold) {
+        eth_busy_poll();
+    }
+}
+
+int eth_stats_print(char *buf, size_t len)
+{
+    int ret = snprintf(buf, len,
+                       "rx_frames,%"PRIu64"\n"
+                       "rx_bytes,%"PRIu64"\n"
+                       "rx_multi_buf_frames,%"PRIu64"\n"
+                       "rx_pool_empty,%"PRIu64"\n"
+                       "rx_dropped_queue_full,%"PRIu64"\n"
+                       "rx_dropped_oversize,%"PRIu64"\n"
+                       "rx_pool_min_free,%"PRIu64"\n"
+                       "rx_bufs_in_stack,%"PRIu64"\n"
+                       "rx_bufs_in_stack_max,%"PRIu64"\n"
+                       "rx_loop_score_exhausted,%"PRIu64"\n"
+                       "tx_frames,%"PRIu64"\n"
+                       "tx_bytes,%"PRIu64"\n"
+                       "tx_pool_empty,%"PRIu64"\n"
+                       "tx_ring_full,%"PRIu64"\n"
+                       "poll_mode_entries,%"PRIu64"\n",
+                       eth_stats.rx_frames, eth_stats.rx_bytes, eth_stats.rx_multi_buf_frames,
+                       eth_stats.rx_pool_empty, eth_stats.rx_dropped_queue_full,
+                       eth_stats.rx_dropped_oversize, eth_stats.rx_pool_min_free,
+                       eth_stats.rx_bufs_in_stack, eth_stats.rx_bufs_in_stack_max,
+                       eth_stats.rx_loop_score_exhausted, eth_stats.tx_frames, eth_stats.tx_bytes,
+                       eth_stats.tx_pool_empty, eth_stats.tx_ring_full, eth_stats.poll_mode_entries);
+    const char *names[] = {"rx_batch_hist", "tx_batch_hist"};
+    uint64_t *hists[] = {eth_stats.rx_batch_hist, eth_stats.tx_batch_hist};
+    for (int h = 0; h < ARRAY_SIZE(hists); h++) {
+        ret += snprintf(buf + MIN(ret, len), len - MIN(ret, len), "%s", names[h]);
+        for (int i = 0; i < ETH_STATS_HIST_BUCKETS; i++) {
+            ret += snprintf(buf + MIN(ret, len), len - MIN(ret, len), ",%"PRIu64, hists[h][i]);
+        }
+        ret += snprintf(buf + MIN(ret, len), len - MIN(ret, len), "\n");
+    }
+    return ret;
 }
 
 static int hardware_interface_searcher(void *cookie, void *interface_instance, char **properties)
@@ -210,40 +553,45 @@ int setup_eth0(ps_io_ops_t *io_ops)
         ZF_LOGE("Unable to find an ethernet device");
         return -1;
     }
+    dma_manager = &io_ops->dma_manager;
+    for (int i = 0; i < NUM_RX_CLIENTS; i++) {
+        rx_clients[i].pending_rx = (spsc_ring_t *)pending_rx_storage[i];
+        spsc_ring_init(rx_clients[i].pending_rx, ETH_RING_SLOTS);
+    }
+    /* Everything currently goes to the local picotcp stack */
+    rx_classifier_set_default(PICO_RX_CLIENT);
+#if NUM_RX_CLIENTS > 1
+    /* Give the echo ports their own rules so that builds with more clients
+     * exercise rule lookups as well as the default */
+    if (rx_classifier_add_rule(RX_CLASSIFIER_ETHERTYPE_IPV4, RX_CLASSIFIER_PROTO_TCP, TCP_ECHO_PORT, PICO_RX_CLIENT) ||
+        rx_classifier_add_rule(RX_CLASSIFIER_ETHERTYPE_IPV4, RX_CLASSIFIER_PROTO_UDP, UDP_ECHO_PORT, PICO_RX_CLIENT)) {
+        ZF_LOGE("Failed to add RX classifier rules");
+        return -1;
+    }
+#endif
+    spsc_ring_init(rx_buf_pool, ETH_RING_SLOTS);
+    spsc_ring_init(tx_buf_pool, ETH_RING_SLOTS);
 
     /* preallocate buffers */
+    if (eth_bufs_alloc(&io_ops->dma_manager, &rx_arena, rx_bufs, RX_BUFS, false)) {
+        ZF_LOGE("Failed to allocate RX buffers.");
+        return -1;
+    }
     for (int i = 0; i < RX_BUFS; i++) {
-        eth_buf_t *buf = &rx_bufs[i];
-        buf->buf = ps_dma_alloc(&io_ops->dma_manager, BUF_SIZE, 64, 0, PS_MEM_NORMAL);
-        if (!buf) {
-            ZF_LOGE("Failed to allocate RX buffer.");
-            return -1;
-        }
-        memset(buf->buf, 0, BUF_SIZE);
-        buf->phys = ps_dma_pin(&io_ops->dma_manager, buf->buf, BUF_SIZE);
-        if (!buf->phys) {
-            ZF_LOGE("ps_dma_pin: Failed to return physical address.");
-            return -1;
-        }
-        rx_buf_pool[num_rx_bufs] = buf;
-        num_rx_bufs++;
+        rx_bufs_sorted[i] = &rx_bufs[i];
+        spsc_ring_enqueue(rx_buf_pool, (uintptr_t)&rx_bufs[i]);
+    }
+    if (!rx_arena.vaddr) {
+        qsort(rx_bufs_sorted, RX_BUFS, sizeof(rx_bufs_sorted[0]), eth_buf_compare);
     }
 
+    /* TX buffers are only ever written by the CPU, so prefer cached memory */
+    if (eth_bufs_alloc(&io_ops->dma_manager, &tx_arena, tx_bufs, TX_BUFS, true)) {
+        ZF_LOGE("Failed to allocate TX buffers.");
+        return -1;
+    }
     for (int i = 0; i < TX_BUFS; i++) {
-        eth_buf_t *buf = &tx_bufs[i];
-        buf->buf = ps_dma_alloc(&io_ops->dma_manager, BUF_SIZE, 64, 0, PS_MEM_NORMAL);
-        if (!buf) {
-            ZF_LOGE("Failed to allocate TX buffer: %d.", i);
-            return -1;
-        }
-        memset(buf->buf, 0, BUF_SIZE);
-        buf->phys = ps_dma_pin(&io_ops->dma_manager, buf->buf, BUF_SIZE);
-        if (!buf->phys) {
-            ZF_LOGE("ps_dma_pin: Failed to return physical address.");
-            return -1;
-        }
-        tx_buf_pool[num_tx] = buf;
-        num_tx++;
+        spsc_ring_enqueue(tx_buf_pool, (uintptr_t)&tx_bufs[i]);
     }
 
     /* Setup ethdriver callbacks and poll the driver so it can do any more init. */
@@ -254,9 +602,13 @@ int setup_eth0(ps_io_ops_t *io_ops)
     /* Setup pico device to install into picotcp */
     pico_dev.send = pico_eth_send;
     pico_dev.poll = pico_eth_poll;
+    rx_clients[PICO_RX_CLIENT].dev = &pico_dev;
     uint8_t mac[6] = {0};
     eth_driver->i_fn.get_mac(eth_driver, mac);
-    pico_dev.mtu = 1500;
+    if (mtu > ETH_MTU) {
+        ZF_LOGF("mtu attribute %d is larger than the ETH_MTU (%d) buffers were sized for", mtu, ETH_MTU);
+    }
+    pico_dev.mtu = mtu;
     if (pico_device_init(&pico_dev, "eth0", mac) != 0) {
         ZF_LOGF("Failed to initialize pico device");
     }
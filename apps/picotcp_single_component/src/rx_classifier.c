@@ -0,0 +1,122 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <tuning_params.h>
+
+#include "rx_classifier.h"
+
+/* This file implements the classification stage that decides which client an
+ * incoming frame is delivered to. Rules are stored in an open addressed hash
+ * table keyed on (ethertype, IP protocol, destination port).
+ */
+
+#define ETH_HDR_LEN 14
+#define ETH_TYPE_OFFSET 12
+#define ETH_TYPE_VLAN 0x8100
+#define VLAN_TAG_LEN 4
+
+typedef struct rx_rule {
+    bool used;
+    uint16_t ethertype;
+    uint8_t proto;
+    uint16_t port;
+    int client;
+} rx_rule_t;
+
+static rx_rule_t rules[RX_CLASSIFIER_SLOTS];
+static int default_client;
+
+static inline uint32_t rule_hash(uint16_t ethertype, uint8_t proto, uint16_t port)
+{
+    uint32_t key = ((uint32_t)ethertype << 16) ^ ((uint32_t)proto << 8) ^ port ^ ((uint32_t)port << 20);
+    /* Knuth multiplicative hash */
+    return (key * 2654435761u) & (RX_CLASSIFIER_SLOTS - 1);
+}
+
+static rx_rule_t *rule_find(uint16_t ethertype, uint8_t proto, uint16_t port)
+{
+    uint32_t idx = rule_hash(ethertype, proto, port);
+    for (int i = 0; i < RX_CLASSIFIER_SLOTS; i++) {
+        rx_rule_t *rule = &rules[(idx + i) & (RX_CLASSIFIER_SLOTS - 1)];
+        if (!rule->used) {
+            return NULL;
+        }
+        if (rule->ethertype == ethertype && rule->proto == proto && rule->port == port) {
+            return rule;
+        }
+    }
+    return NULL;
+}
+
+int rx_classifier_add_rule(uint16_t ethertype, uint8_t proto, uint16_t port, int client)
+{
+    rx_rule_t *rule = rule_find(ethertype, proto, port);
+    if (rule) {
+        rule->client = client;
+        return 0;
+    }
+    uint32_t idx = rule_hash(ethertype, proto, port);
+    for (int i = 0; i < RX_CLASSIFIER_SLOTS; i++) {
+        rule = &rules[(idx + i) & (RX_CLASSIFIER_SLOTS - 1)];
+        if (!rule->used) {
+            *rule = (rx_rule_t) {
+                .used = true,
+                .ethertype = ethertype,
+                .proto = proto,
+                .port = port,
+                .client = client,
+            };
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void rx_classifier_set_default(int client)
+{
+    default_client = client;
+}
+
+int rx_classifier_classify(const uint8_t *frame, size_t len)
+{
+    if (len < ETH_HDR_LEN) {
+        return default_client;
+    }
+    size_t offset = ETH_TYPE_OFFSET;
+    uint16_t ethertype = (frame[offset] << 8) | frame[offset + 1];
+    if (ethertype == ETH_TYPE_VLAN && len >= ETH_HDR_LEN + VLAN_TAG_LEN) {
+        offset += VLAN_TAG_LEN;
+        ethertype = (frame[offset] << 8) | frame[offset + 1];
+    }
+    offset += 2;
+
+    uint8_t proto = RX_CLASSIFIER_ANY_PROTO;
+    uint16_t port = RX_CLASSIFIER_ANY_PORT;
+    if (ethertype == RX_CLASSIFIER_ETHERTYPE_IPV4 && len >= offset + 20) {
+        const uint8_t *ip = frame + offset;
+        size_t ihl = (ip[0] & 0xf) * 4;
+        bool first_fragment = ((ip[6] & 0x1f) | ip[7]) == 0;
+        proto = ip[9];
+        /* Only the first fragment carries the transport header */
+        if ((proto == RX_CLASSIFIER_PROTO_TCP || proto == RX_CLASSIFIER_PROTO_UDP) && first_fragment &&
+            len >= offset + ihl + 4) {
+            const uint8_t *l4 = ip + ihl;
+            port = (l4[2] << 8) | l4[3];
+        }
+    }
+
+    rx_rule_t *rule = rule_find(ethertype, proto, port);
+    if (!rule && port != RX_CLASSIFIER_ANY_PORT) {
+        rule = rule_find(ethertype, proto, RX_CLASSIFIER_ANY_PORT);
+    }
+    if (!rule && proto != RX_CLASSIFIER_ANY_PROTO) {
+        rule = rule_find(ethertype, RX_CLASSIFIER_ANY_PROTO, RX_CLASSIFIER_ANY_PORT);
+    }
+    return rule ? rule->client : default_client;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Field values for IPv4 TCP and UDP rules */
+#define RX_CLASSIFIER_ETHERTYPE_IPV4 0x0800
+#define RX_CLASSIFIER_PROTO_TCP 6
+#define RX_CLASSIFIER_PROTO_UDP 17
+
+/* Wildcard values for rules that don't care about a field */
+#define RX_CLASSIFIER_ANY_PROTO 0
+#define RX_CLASSIFIER_ANY_PORT 0
+
+/**
+ * Route frames matching a rule to a client.
+ *
+ * Rules are exact matches on (ethertype, IP protocol, destination port), with
+ * the protocol and port able to be wildcarded. A frame is matched against the
+ * most specific rule first, then with the port wildcarded and then with both
+ * the protocol and port wildcarded.
+ *
+ * @param ethertype  Ethertype in host byte order
+ * @param proto      IP protocol number or RX_CLASSIFIER_ANY_PROTO
+ * @param port       TCP/UDP destination port in host byte order or RX_CLASSIFIER_ANY_PORT
+ * @param client     Client to deliver matching frames to
+ *
+ * @return 0 on success, -1 if the table is full
+ */
+int rx_classifier_add_rule(uint16_t ethertype, uint8_t proto, uint16_t port, int client);
+
+/* Set the client that receives frames that don't match any rule. */
+void rx_classifier_set_default(int client);
+
+/**
+ * Find the client that a frame should be delivered to.
+ *
+ * @param frame  Start of the ethernet header
+ * @param len    Number of contiguous bytes available at frame
+ *
+ * @return client ID
+ */
+int rx_classifier_classify(const uint8_t *frame, size_t len);
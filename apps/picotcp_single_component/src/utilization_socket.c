@@ -4,18 +4,25 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 #include <autoconf.h>
+#include <inttypes.h>
 #include <stdbool.h>
+#include <stdlib.h>
 
 #include <camkes.h>
 #include <ethdrivers/raw.h>
+#ifdef CONFIG_BENCHMARK_TRACK_UTILISATION
+#include <sel4/benchmark_utilisation_types.h>
+#endif
 
 #undef PACKED
 #include <pico_stack.h>
 #include <pico_socket.h>
 #include <pico_ipv4.h>
 
-#include "ports.h"
-#include "tuning_params.h"
+#include <ports.h>
+#include <tuning_params.h>
+
+#include "eth_stats.h"
 
 /* This file implements a TCP based utilization measurment process that starts
  * and stops utilization measurements based on a client's requests.
@@ -37,6 +44,32 @@
  *
  * It is also possible for client to send QUIT\n during operation.
  *
+ * At any point after HELLO the client can also send STATS\n to read the
+ * ethernet datapath counters without affecting a running measurement:
+ * - Client sends: STATS\n
+ * - Server sends: 220 VALID DATA (Data to follow)\n
+                   Content-length: %d\n
+                   ${counters}\n
+ * The counters are "name,value" lines, and batch size histograms are
+ * "name,bucket0,bucket1,..." lines.
+ *
+ * Instead of START, the client can send STREAM to be sent a sample every
+ * interval until it sends STOP:
+ * - Client sends: STREAM [interval_ms]\n
+ * - Server sends: 200 OK\n
+ * - Every interval_ms milliseconds (UTILIZATION_STREAM_INTERVAL_MS if not given)
+ *   Server sends: 220 VALID DATA (Data to follow)\n
+                   Content-length: %d\n
+                   ${sample}\n
+ * - Client sends: STOP\n
+ * - Server sends a last sample covering the time since the previous one.
+ * - Server closes socket.
+ * Each sample is a line of
+ * "seq,idle,total,kernel,ethdriver_total,ethdriver_kernel" cycle counts for
+ * that interval only. The ethdriver columns are the cycles spent running this
+ * component's thread and the kernel cycles spent on its behalf, and are only
+ * filled in if the kernel tracks per-thread utilisation.
+ *
  * The server starts recording utilization stats when it receives START and
  * finishes recording when it receives STOP.
  *
@@ -45,6 +78,7 @@
 
 struct pico_socket *utiliz_socket;
 char utilz_mesg[0x1000] ALIGN(0x1000);
+char stats_mesg[0x1000];
 #define WHOAMI "100 IPBENCH V1.0\n"
 #define HELLO "HELLO\n"
 #define OK_READY "200 OK (Ready to go)\n"
@@ -54,12 +88,70 @@ char utilz_mesg[0x1000] ALIGN(0x1000);
 #define START "START\n"
 #define STOP "STOP\n"
 #define QUIT "QUIT\n"
+#define STATS "STATS\n"
+#define STREAM "STREAM"
 #define RESPONSE "220 VALID DATA (Data to follow)\n" \
                  "Content-length: %d\n" \
                  "%s\n"
 #define IDLE_FORMAT ",%ld,%ld"
+#define SAMPLE_FORMAT "%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64
 #define msg_match(msg, match) (strncmp(msg, match, strlen(match))==0)
 
+/* Socket that streamed samples are sent to, NULL when not streaming */
+static struct pico_socket *stream_socket;
+/* picotcp timer for the next sample */
+static uint32_t stream_timer;
+static uint32_t stream_interval_ms;
+static uint64_t stream_seq;
+
+/* Start a new measurement window */
+static void utilization_window_start(void)
+{
+#ifdef CONFIG_BENCHMARK_TRACK_UTILISATION
+    seL4_BenchmarkResetThreadUtilisation(camkes_get_tls()->tcb_cap);
+#endif
+    idle_start();
+}
+
+/* Finish the current measurement window and send it as a sample */
+static void utilization_window_send(struct pico_socket *s)
+{
+    uint64_t total, kernel, idle;
+    uint64_t thread_total = 0, thread_kernel = 0;
+    idle_stop(&total, &kernel, &idle);
+#ifdef CONFIG_BENCHMARK_TRACK_UTILISATION
+    seL4_BenchmarkGetThreadUtilisation(camkes_get_tls()->tcb_cap);
+    uint64_t *buffer = (uint64_t *) &seL4_GetIPCBuffer()->msg[0];
+    thread_total = buffer[BENCHMARK_TCB_UTILISATION];
+    thread_kernel = buffer[BENCHMARK_TCB_KERNEL_UTILISATION];
+#endif
+    int len = snprintf(stats_mesg, sizeof(stats_mesg), SAMPLE_FORMAT, stream_seq++, idle, total, kernel,
+                       thread_total, thread_kernel);
+    char *response;
+    len = asprintf(&response, RESPONSE, len + 1, stats_mesg);
+    if (len == -1) {
+        ZF_LOGE("asprintf: Failed to print string");
+    } else {
+        pico_socket_send(s, response, len);
+        free(response);
+    }
+}
+
+static void utilization_stream_tick(UNUSED pico_time now, UNUSED void *arg)
+{
+    utilization_window_send(stream_socket);
+    utilization_window_start();
+    stream_timer = pico_timer_add(stream_interval_ms, utilization_stream_tick, NULL);
+}
+
+static void utilization_stream_stop(void)
+{
+    if (stream_socket != NULL) {
+        pico_timer_cancel(stream_timer);
+        stream_socket = NULL;
+    }
+}
+
 /* Event handler for ipbench utilization test */
 void handle_tcp_utiliz_notification(uint16_t events, struct pico_socket *s)
 {
@@ -79,12 +171,14 @@ void handle_tcp_utiliz_notification(uint16_t events, struct pico_socket *s)
     }
 
     if (events & PICO_SOCK_EV_RD) {
-        ret = pico_socket_recv(s, utilz_mesg, 0x1000);
+        ret = pico_socket_recv(s, utilz_mesg, sizeof(utilz_mesg) - 1);
         if (ret == -1) {
             printf("received -1\n");
         } else if (ret == 0) {
             printf("Error\n");
         }
+        /* Terminate the message so that STREAM's argument can be parsed */
+        utilz_mesg[MAX(ret, 0)] = '\0';
         if (msg_match(utilz_mesg, HELLO)) {
             pico_socket_send(s, OK_READY, strlen(OK_READY));
         } else if (msg_match(utilz_mesg, LOAD)) {
@@ -93,6 +187,21 @@ void handle_tcp_utiliz_notification(uint16_t events, struct pico_socket *s)
             pico_socket_send(s, OK, strlen(OK));
         } else if (msg_match(utilz_mesg, START)) {
             idle_start();
+        } else if (msg_match(utilz_mesg, STREAM)) {
+            stream_interval_ms = strtoul(utilz_mesg + strlen(STREAM), NULL, 10);
+            if (stream_interval_ms == 0) {
+                stream_interval_ms = UTILIZATION_STREAM_INTERVAL_MS;
+            }
+            pico_socket_send(s, OK, strlen(OK));
+            utilization_stream_stop();
+            stream_socket = s;
+            stream_seq = 0;
+            utilization_window_start();
+            stream_timer = pico_timer_add(stream_interval_ms, utilization_stream_tick, NULL);
+        } else if (msg_match(utilz_mesg, STOP) && stream_socket == s) {
+            utilization_stream_stop();
+            utilization_window_send(s);
+            pico_socket_shutdown(s, PICO_SHUT_RDWR);
         } else if (msg_match(utilz_mesg, STOP)) {
             uint64_t total, kernel, idle;
             idle_stop(&total, &kernel, &idle);
@@ -112,12 +221,31 @@ void handle_tcp_utiliz_notification(uint16_t events, struct pico_socket *s)
                 free(util_msg);
             }
             pico_socket_shutdown(s, PICO_SHUT_RDWR);
+        } else if (msg_match(utilz_mesg, STATS)) {
+            int len = eth_stats_print(stats_mesg, sizeof(stats_mesg));
+            if (len < 0 || len >= sizeof(stats_mesg)) {
+                ZF_LOGE("eth_stats_print: Failed to print counters");
+            } else {
+                char *response;
+                len = asprintf(&response, RESPONSE, len + 1, stats_mesg);
+                if (len == -1) {
+                    ZF_LOGE("asprintf: Failed to print string");
+                } else {
+                    pico_socket_send(s, response, len);
+                    free(response);
+                }
+            }
         } else if (msg_match(utilz_mesg, QUIT)) {
         } else {
             printf("Couldn't match message: %s\n", utilz_mesg);
         }
     }
 
+    /* Stop streaming as soon as the socket is going away, so the timer
+     * doesn't send samples to a dead socket */
+    if ((events & (PICO_SOCK_EV_CLOSE | PICO_SOCK_EV_FIN | PICO_SOCK_EV_ERR)) && stream_socket == s) {
+        utilization_stream_stop();
+    }
     if (events & PICO_SOCK_EV_CLOSE) {
         ret = pico_socket_shutdown(s, PICO_SHUT_RDWR);
         printf("%s: Connection closing on socket %p\n", get_instance_name(), s);
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+#
+# Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+"""
+Measure how the TCP echo server scales with the number of connections.
+
+For each connection count, opens that many connections to the echo port and
+has every connection repeatedly send a message and wait for it to be echoed
+back. Reports the connection setup time, the aggregate echo rate and the mean
+round trip time for each step.
+
+Example:
+    ./tcp_conn_scale.py 10.13.1.74 --counts 1 10 100 1000 4000
+"""
+
+import argparse
+import asyncio
+import time
+
+
+async def echo_client(host, port, payload, deadline, results):
+    reader, writer = await asyncio.open_connection(host, port)
+    results['connected'] += 1
+    try:
+        while time.monotonic() < deadline:
+            start = time.monotonic()
+            writer.write(payload)
+            await writer.drain()
+            await reader.readexactly(len(payload))
+            results['rtt_total'] += time.monotonic() - start
+            results['echoes'] += 1
+    finally:
+        writer.close()
+        await writer.wait_closed()
+
+
+async def run_step(host, port, count, size, duration):
+    payload = bytes(size)
+    results = {'connected': 0, 'echoes': 0, 'rtt_total': 0.0}
+    start = time.monotonic()
+    deadline = start + duration
+    tasks = [asyncio.ensure_future(echo_client(host, port, payload, deadline, results))
+             for _ in range(count)]
+    done = await asyncio.gather(*tasks, return_exceptions=True)
+    errors = [e for e in done if isinstance(e, Exception)]
+    elapsed = time.monotonic() - start
+    rtt_us = results['rtt_total'] / results['echoes'] * 1e6 if results['echoes'] else 0
+    print("%6d connections: %6d connected, %5d errors, %10.1f echoes/s, mean rtt %8.1f us" %
+          (count, results['connected'], len(errors), results['echoes'] / elapsed, rtt_us))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('host', help='address of the echo server')
+    parser.add_argument('--port', type=int, default=1234, help='TCP echo port')
+    parser.add_argument('--counts', type=int, nargs='+', default=[1, 10, 100, 1000, 4000],
+                        help='connection counts to step through')
+    parser.add_argument('--size', type=int, default=64, help='message size in bytes')
+    parser.add_argument('--duration', type=float, default=10, help='seconds per step')
+    args = parser.parse_args()
+
+    for count in args.counts:
+        asyncio.get_event_loop().run_until_complete(
+            run_step(args.host, args.port, count, args.size, args.duration))
+
+
+if __name__ == '__main__':
+    main()
@@ -6,6 +6,8 @@
 
 #include <camkes.h>
 #include <autoconf.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <camkes/virtqueue.h>
 #include <camkes/dataport.h>
@@ -38,7 +40,10 @@ extern int peer_socket;
 
 /* TCP Echo sockets */
 extern int socket_in;
-extern int tcp_echo_client;
+/* Whether socket is a connected TCP echo client */
+bool tcp_socket_is_client(int socket);
+/* Whether msg is one of the TCP echo server's buffers */
+bool tcp_socket_owns_msg(tx_msg_t *msg);
 
 /* UDP echo socket */
 extern int udp_socket;
@@ -50,7 +55,28 @@ extern void *echo_recv_buf;
 extern virtqueue_driver_t tx_virtqueue;
 extern virtqueue_driver_t rx_virtqueue;
 
-/* async virtqueue identifiers */
-#define TCP_SOCKETS_ASYNC_ID 1
+/* Counters for the notifications exchanged with the picoserver */
+typedef struct echo_stats {
+    /* Signals sent to the picoserver */
+    uint64_t notifications_sent;
+    /* Async and sync event notifications received from the picoserver */
+    uint64_t async_events;
+    uint64_t sync_events;
+    /* event_poll RPCs made to the picoserver */
+    uint64_t events_polled;
+    /* Payload bytes handed back to the picoserver to send */
+    uint64_t bytes_echoed;
+} echo_stats_t;
+
+extern echo_stats_t echo_stats;
+
+/* Make a buffer available on a virtqueue. The picoserver is only notified once
+ * the current event has been handled, and only if something was enqueued. */
+bool echo_enqueue_buf(virtqueue_driver_t *vq, tx_msg_t *msg, unsigned len);
+
+/* Print the notification counters per echoed megabyte and reset them */
+void echo_stats_report(void);
+
+/* async virtqueue identifier of UDP buffers. TCP buffers point to their own state. */
 #define UDP_SOCKETS_ASYNC_ID 2
 
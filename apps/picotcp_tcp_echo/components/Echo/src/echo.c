@@ -6,8 +6,11 @@
 
 
 #include <assert.h>
+#include <inttypes.h>
+#include <string.h>
 #include <camkes/io.h>
 #include "client.h"
+#include "reservation.h"
 
 
 seL4_CPtr echo_control_notification();
@@ -15,28 +18,81 @@ seL4_CPtr echo_control_notification();
 virtqueue_driver_t tx_virtqueue;
 virtqueue_driver_t rx_virtqueue;
 
+echo_stats_t echo_stats;
 
-static void handle_picoserver_notification(UNUSED seL4_Word badge, UNUSED void *cookie)
+/* Whether buffers have been enqueued since the picoserver was last notified */
+static bool notify_pending;
+
+bool echo_enqueue_buf(virtqueue_driver_t *vq, tx_msg_t *msg, unsigned len)
 {
-    picoserver_event_t server_event = echo_control_event_poll();
-    int socket = 0;
-    uint16_t events = 0;
-    while (server_event.num_events_left > 0 || server_event.events) {
-        socket = server_event.socket_fd;
-        events = server_event.events;
-        if (socket == utiliz_socket || socket == peer_socket) {
-            handle_tcp_utiliz_notification(events, socket);
-            server_event = echo_control_event_poll();
-        } else if (socket == socket_in || socket == tcp_echo_client) {
-            handle_tcp_echo_notification(events, socket);
-            server_event = echo_control_event_poll();
+    virtqueue_ring_object_t handle;
+    virtqueue_init_ring_object(&handle);
+    if (!virtqueue_add_available_buf(vq, &handle, ENCODE_DMA_ADDRESS(msg), len, VQ_RW)) {
+        return false;
+    }
+    notify_pending = true;
+    return true;
+}
 
-        } else {
-            ZF_LOGE("Got event for socket: %d but no registered handler", socket);
-        }
+/* One notification covers everything enqueued on either queue since the last one */
+static void echo_notify_server(void)
+{
+    if (notify_pending) {
+        notify_pending = false;
+        echo_stats.notifications_sent++;
+        tx_virtqueue.notify();
+    }
+}
 
-        server_event = echo_control_event_poll();
+void echo_stats_report(void)
+{
+    uint64_t mb = echo_stats.bytes_echoed / (1024 * 1024);
+    printf("%s: %"PRIu64" bytes echoed, %"PRIu64" notifications sent, %"PRIu64" async and %"PRIu64
+           " sync events received, %"PRIu64" socket events polled\n", get_instance_name(),
+           echo_stats.bytes_echoed, echo_stats.notifications_sent, echo_stats.async_events,
+           echo_stats.sync_events, echo_stats.events_polled);
+    if (mb > 0) {
+        printf("%s: %"PRIu64" notifications sent and %"PRIu64" received per MiB\n", get_instance_name(),
+               echo_stats.notifications_sent / mb, (echo_stats.async_events + echo_stats.sync_events) / mb);
     }
+    memset(&echo_stats, 0, sizeof(echo_stats));
+}
+
+
+static void dispatch_picoserver_event(picoserver_event_t *server_event)
+{
+    int socket = server_event->socket_fd;
+    uint16_t events = server_event->events;
+    if (socket == utiliz_socket || socket == peer_socket) {
+        handle_tcp_utiliz_notification(events, socket);
+    } else if (socket == socket_in || tcp_socket_is_client(socket)) {
+        handle_tcp_echo_notification(events, socket);
+    } else {
+        ZF_LOGE("Got event for socket: %d but no registered handler", socket);
+    }
+}
+
+/*
+ * Drain every pending socket event, one event_poll call per event. Each
+ * reply says how many events are still queued, so the last call is the one
+ * that reports none left rather than an extra empty poll.
+ */
+static void handle_picoserver_notification(UNUSED seL4_Word badge, UNUSED void *cookie)
+{
+    echo_stats.sync_events++;
+    reservation_enter();
+    picoserver_event_t server_event;
+    do {
+        reservation_check();
+        server_event = echo_control_event_poll();
+        echo_stats.events_polled++;
+        if (server_event.events) {
+            dispatch_picoserver_event(&server_event);
+        }
+    } while (server_event.num_events_left > 0);
+    reservation_check();
+    /* Accepting a connection hands the picoserver receive buffers */
+    echo_notify_server();
 }
 
 static tx_msg_t *get_msg_from_queue(virtqueue_driver_t *queue)
@@ -61,8 +117,10 @@ static tx_msg_t *get_msg_from_queue(virtqueue_driver_t *queue)
 
 static void async_event(UNUSED seL4_Word badge, void *cookie)
 {
+    echo_stats.async_events++;
+    reservation_enter();
     while (true) {
-
+        reservation_check();
         tx_msg_t *msg = get_msg_from_queue(&tx_virtqueue);
         if (!msg) {
             break;
@@ -70,28 +128,28 @@ static void async_event(UNUSED seL4_Word badge, void *cookie)
         if ((uintptr_t)msg->client_cookie == UDP_SOCKETS_ASYNC_ID) {
             udp_socket_handle_async_sent(msg);
 
-        } else if ((uintptr_t)msg->client_cookie == TCP_SOCKETS_ASYNC_ID) {
+        } else if (tcp_socket_owns_msg(msg)) {
             tcp_socket_handle_async_sent(msg);
         } else {
             ZF_LOGE("Message sent but bad socket: %d", msg->socket_fd);
         }
     }
     while (true) {
-
+        reservation_check();
         tx_msg_t *msg = get_msg_from_queue(&rx_virtqueue);
         if (!msg) {
             break;
         }
         if ((uintptr_t)msg->client_cookie == UDP_SOCKETS_ASYNC_ID) {
             udp_socket_handle_async_received(msg);
-        } else if ((uintptr_t)msg->client_cookie == TCP_SOCKETS_ASYNC_ID) {
+        } else if (tcp_socket_owns_msg(msg)) {
             tcp_socket_handle_async_received(msg);
         } else {
             ZF_LOGE("Message received but bad socket: %d", msg->socket_fd);
         }
     }
 
-    tx_virtqueue.notify();
+    echo_notify_server();
 }
 
 
@@ -117,7 +175,7 @@ int setup_echo_server(ps_io_ops_t *io_ops)
     single_threaded_component_register_handler(tx_badge, "async_notification", async_event, NULL);
     single_threaded_component_register_handler(echo_control_notification_badge(), "sync_notification",
                                                handle_picoserver_notification, NULL);
-    tx_virtqueue.notify();
+    echo_notify_server();
     return 0;
 }
 
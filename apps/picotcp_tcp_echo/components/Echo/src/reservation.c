@@ -0,0 +1,85 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "reservation.h"
+#include "tuning_params.h"
+
+#if ECHO_RESERVATION
+
+#include <camkes.h>
+#include <sel4bench/sel4bench.h>
+
+static struct {
+    /* Cycle count at START */
+    uint64_t start;
+    /* Cycle count at the last enter or check */
+    uint64_t last;
+    /* Gaps longer than RESERVATION_GAP_CYCLES, and the cycles spent in them */
+    uint64_t overruns;
+    uint64_t throttled_cycles;
+    /* Cycles spent handling events, not counting the gaps */
+    uint64_t busy_cycles;
+} reservation;
+
+void reservation_enter(void)
+{
+    reservation.last = (uint64_t)sel4bench_get_cycle_count();
+}
+
+void reservation_check(void)
+{
+    uint64_t now = (uint64_t)sel4bench_get_cycle_count();
+    uint64_t diff = now - reservation.last;
+    if (diff > RESERVATION_GAP_CYCLES) {
+        reservation.overruns++;
+        reservation.throttled_cycles += diff;
+    } else {
+        reservation.busy_cycles += diff;
+    }
+    reservation.last = now;
+}
+
+void reservation_report(uint64_t bytes_echoed)
+{
+    uint64_t elapsed = (uint64_t)sel4bench_get_cycle_count() - reservation.start;
+    uint64_t used_pct = elapsed ? reservation.busy_cycles * 100 / elapsed : 0;
+    printf("%s: reservation %d/%d us (%d%%), used %"PRIu64"%% of %"PRIu64" cycles, %"PRIu64
+           " overruns, %"PRIu64" cycles throttled\n", get_instance_name(), ECHO_BUDGET_US,
+           RESERVATION_PERIOD_US, ECHO_BUDGET_US * 100 / RESERVATION_PERIOD_US, used_pct, elapsed,
+           reservation.overruns, reservation.throttled_cycles);
+    /* Per busy cycle is what the reservation sustains for each unit of budget consumed */
+    if (elapsed && reservation.busy_cycles) {
+        printf("%s: %"PRIu64" bytes per Mcycle elapsed, %"PRIu64" bytes per Mcycle busy\n",
+               get_instance_name(), bytes_echoed * 1000000 / elapsed,
+               bytes_echoed * 1000000 / reservation.busy_cycles);
+    }
+}
+
+void reservation_reset(void)
+{
+    reservation.start = (uint64_t)sel4bench_get_cycle_count();
+    reservation.last = reservation.start;
+    reservation.overruns = 0;
+    reservation.throttled_cycles = 0;
+    reservation.busy_cycles = 0;
+}
+
+static int setup_reservation(UNUSED ps_io_ops_t *io_ops)
+{
+#if !ECHO_TRACE
+    /* The trace module initialises the counters when it is enabled */
+    sel4bench_init();
+#endif
+    reservation_reset();
+    return 0;
+}
+
+CAMKES_POST_INIT_MODULE_DEFINE(setup_reservation_, setup_reservation);
+
+#endif
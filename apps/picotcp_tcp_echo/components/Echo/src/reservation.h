@@ -0,0 +1,44 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Budget accounting for Echo's scheduling context, enabled with the
+ * PICOTCP_ECHO_MCS CMake option.
+ *
+ * reservation_check compares the cycle counter with the previous check while
+ * Echo is handling an event, either a virtqueue notification or a socket
+ * event notification that it polls the picoserver for over RPC. Any gap of
+ * more than RESERVATION_GAP_CYCLES counts as an overrun. A gap is usually Echo
+ * running out of ECHO_BUDGET_US and waiting for the next replenishment, but it
+ * can also be preemption by a higher priority component such as the serial or
+ * timer servers, or time blocked in a synchronous RPC made while handling the
+ * event. The count is an upper bound on budget exhaustion.
+ *
+ * reservation_report prints the overruns and Echo's busy share of the run,
+ * along with the echoed bytes per million cycles elapsed and per million
+ * cycles Echo was busy.
+ */
+
+#if ECHO_RESERVATION
+
+/* Echo started handling an event */
+void reservation_enter(void);
+/* Echo is between two pieces of work within an event */
+void reservation_check(void);
+void reservation_report(uint64_t bytes_echoed);
+void reservation_reset(void);
+
+#else
+
+static inline void reservation_enter(void) {}
+static inline void reservation_check(void) {}
+static inline void reservation_report(uint64_t bytes_echoed) {}
+static inline void reservation_reset(void) {}
+
+#endif
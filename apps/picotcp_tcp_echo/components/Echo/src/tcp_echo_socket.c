@@ -8,81 +8,172 @@
 #include <string.h>
 
 #include "client.h"
+#include "trace.h"
 
-#define PRINT_RECEIVE_PACKET_IDS 0
-#if PRINT_RECEIVE_PACKET_IDS
-static uint64_t received_len;
-#endif
+/* This file implements the TCP echo server on top of the async picoserver
+ * interface. Up to MAX_TCP_CONNS clients can be connected at once.
+ *
+ * The NUM_TCP_BUFS buffers are shared by all of the connections. A buffer is
+ * lent to a connection by posting it on the RX virtqueue for that socket, goes
+ * to the TX virtqueue once it holds data and is returned to the shared pool
+ * once the data has been sent. The pool is split evenly between the open
+ * connections, so a single connection can use all of it, and free buffers are
+ * handed out to the connections in round-robin order so one busy connection
+ * can't starve the others. When another connection opens, buffers over the new
+ * share come back to the pool as their data is echoed.
+ *
+ * Each buffer remembers which connection, and which generation of that
+ * connection, it was lent to. Buffers still in flight when a connection
+ * closes are recognised when they come back and returned to the pool, even if
+ * the socket number has been reused by then.
+ *
+ * With tracing enabled, the load generator is expected to send packets of
+ * TCP_READ_SIZE bytes that each start with a 64-bit packet ID. The IDs are
+ * picked out of the byte stream to timestamp the packets as they pass
+ * through this component.
+ */
 
+typedef struct tcp_conn {
+    int socket;
+    bool open;
+    /* Incremented each time the slot is used for a new connection */
+    uint32_t gen;
+    /* Buffers lent to this connection */
+    uint32_t bufs_lent;
+    /* Bytes of the current TCP_READ_SIZE packet received so far */
+    uint32_t packet_offset;
+} tcp_conn_t;
+
+/* State for each buffer, pointed to by the buffer's client_cookie */
+typedef struct tcp_buf {
+    tx_msg_t *msg;
+    tcp_conn_t *conn;
+    uint32_t conn_gen;
+    /* ID of the first packet starting in the buffer, or TRACE_NO_ID */
+    uint64_t trace_id;
+} tcp_buf_t;
+
+static tcp_conn_t conns[MAX_TCP_CONNS];
+static int num_open_conns;
+/* Connection for each socket number */
+static tcp_conn_t *conn_by_socket[MAX_SOCKET_FDS];
+/* Next connection to offer a free buffer to */
+static int next_conn;
+
+static tcp_buf_t tcp_bufs[NUM_TCP_BUFS];
 static int num_rx_bufs = 0;
-static tx_msg_t *rx_buf_pool[NUM_TCP_BUFS];
+static tcp_buf_t *rx_buf_pool[NUM_TCP_BUFS];
 
 
 int socket_in;
-int tcp_echo_client;
 
-int tcp_socket_handle_async_received(tx_msg_t *msg)
+static tcp_conn_t *tcp_conn_lookup(int socket)
 {
-    virtqueue_ring_object_t handle;
-    if (msg->socket_fd != tcp_echo_client) {
-        // socket has been closed
-        if (tcp_echo_client == -1) {
-            rx_buf_pool[num_rx_bufs] = msg;
-            num_rx_bufs++;
-            return 0;
-        } else {
-            msg->socket_fd = tcp_echo_client;
-            msg->done_len = -1;
-        }
+    if (socket < 0 || socket >= MAX_SOCKET_FDS) {
+        return NULL;
+    }
+    return conn_by_socket[socket];
+}
+
+bool tcp_socket_is_client(int socket)
+{
+    return tcp_conn_lookup(socket) != NULL;
+}
+
+bool tcp_socket_owns_msg(tx_msg_t *msg)
+{
+    tcp_buf_t *buf = msg->client_cookie;
+    return buf >= tcp_bufs && buf < tcp_bufs + NUM_TCP_BUFS;
+}
+
+/* Whether the connection the buffer was lent to is still open */
+static bool tcp_buf_conn_live(tcp_buf_t *buf)
+{
+    return buf->conn != NULL && buf->conn->open && buf->conn->gen == buf->conn_gen;
+}
 
+/* Take a buffer back from its connection and put it in the shared pool */
+static void tcp_buf_release(tcp_buf_t *buf)
+{
+    if (tcp_buf_conn_live(buf)) {
+        buf->conn->bufs_lent--;
     }
-    if (msg->done_len == -1 || msg->done_len == 0) {
-        msg->total_len = TCP_READ_SIZE;
-        msg->done_len = 0;
-        virtqueue_init_ring_object(&handle);
-        if (!virtqueue_add_available_buf(&rx_virtqueue, &handle, ENCODE_DMA_ADDRESS(msg), BUF_SIZE, VQ_RW)) {
-            ZF_LOGF("tcp_handle_received: Error while enqueuing available buffer, queue full");
-        }
+    buf->conn = NULL;
+    buf->msg->socket_fd = -1;
+    rx_buf_pool[num_rx_bufs] = buf;
+    num_rx_bufs++;
+}
 
-    } else {
-        msg->total_len = msg->done_len;
-#if PRINT_RECEIVE_PACKET_IDS
-        /* Because we could potentially get back less data than we asked for
-         * the packet ID isn't always going to be at the start of the buffer.
-         */
-        if (received_len > 0) {
-            if ((msg->done_len + received_len) >= TCP_READ_SIZE) {
-                msg->done_len -= (TCP_READ_SIZE - received_len);
-                received_len = 0;
-            } else {
-                received_len += msg->done_len;
-                msg->done_len = 0;
+/* Lend free buffers to open connections, one at a time in round-robin order */
+static void tcp_post_rx_bufs(void)
+{
+    if (num_open_conns == 0) {
+        return;
+    }
+    /* Each open connection's share of the pool */
+    uint32_t bufs_per_conn = NUM_TCP_BUFS / num_open_conns;
+    while (num_rx_bufs > 0) {
+        tcp_conn_t *conn = NULL;
+        for (int i = 0; i < MAX_TCP_CONNS; i++) {
+            tcp_conn_t *candidate = &conns[(next_conn + i) % MAX_TCP_CONNS];
+            if (candidate->open && candidate->bufs_lent < bufs_per_conn) {
+                conn = candidate;
+                next_conn = (next_conn + i + 1) % MAX_TCP_CONNS;
+                break;
             }
         }
-        while (msg->done_len > 0 && received_len == 0) {
-            if (msg->done_len < sizeof(uint64_t)) {
-                ZF_LOGE("SPLIT ID received");
-            } else {
-                uint64_t sent_id = *(uint64_t *)&msg->buf[msg->total_len - msg->done_len];
-                printf("ID: %ld\n", sent_id);
-            }
-            if (msg->done_len >= TCP_READ_SIZE) {
-                msg->done_len -= TCP_READ_SIZE;
-            } else {
-                received_len += msg->done_len;
-                msg->done_len = 0;
-            }
+        if (conn == NULL) {
+            return;
         }
-#endif
-        msg->done_len = 0;
-        /* copy the packet over */
-
-        virtqueue_init_ring_object(&handle);
-        if (!virtqueue_add_available_buf(&tx_virtqueue, &handle, ENCODE_DMA_ADDRESS(msg), sizeof(*msg), VQ_RW)) {
-            ZF_LOGF("tcp_handle_received: Error while enqueuing available buffer, queue full");
+        num_rx_bufs--;
+        tcp_buf_t *buf = rx_buf_pool[num_rx_bufs];
+        buf->conn = conn;
+        buf->conn_gen = conn->gen;
+        conn->bufs_lent++;
+        buf->msg->socket_fd = conn->socket;
+        buf->msg->total_len = TCP_READ_SIZE;
+        buf->msg->done_len = 0;
+        if (!echo_enqueue_buf(&rx_virtqueue, buf->msg, BUF_SIZE)) {
+            ZF_LOGF("tcp_post_rx_bufs: Error while enqueuing available buffer, queue full");
         }
+    }
+}
+
+/*
+ * Find the ID of the first packet that starts in msg. Reads can return less
+ * than a whole packet, so the packet boundaries are tracked across reads.
+ */
+static uint64_t tcp_find_packet_id(tcp_conn_t *conn, tx_msg_t *msg)
+{
+    uint64_t id = TRACE_NO_ID;
+    uint32_t start = conn->packet_offset == 0 ? 0 : TCP_READ_SIZE - conn->packet_offset;
+    if (start + sizeof(id) <= msg->done_len) {
+        memcpy(&id, &msg->buf[start], sizeof(id));
+    }
+    conn->packet_offset = (conn->packet_offset + msg->done_len) % TCP_READ_SIZE;
+    return id;
+}
+
+int tcp_socket_handle_async_received(tx_msg_t *msg)
+{
+    tcp_buf_t *buf = msg->client_cookie;
+    if (!tcp_buf_conn_live(buf) || msg->done_len == -1 || msg->done_len == 0) {
+        /* The connection has closed or the read failed */
+        tcp_buf_release(buf);
+        tcp_post_rx_bufs();
+        return 0;
+    }
 
+    msg->total_len = msg->done_len;
+    buf->trace_id = tcp_find_packet_id(buf->conn, msg);
+    trace_record(TRACE_CLIENT_RX, msg->socket_fd, buf->trace_id);
+    msg->done_len = 0;
+    /* copy the packet over */
+
+    if (!echo_enqueue_buf(&tx_virtqueue, msg, sizeof(*msg))) {
+        ZF_LOGF("tcp_handle_received: Error while enqueuing available buffer, queue full");
     }
+    trace_record(TRACE_CLIENT_TX, msg->socket_fd, buf->trace_id);
     return 0;
 
 }
@@ -90,69 +181,72 @@ int tcp_socket_handle_async_received(tx_msg_t *msg)
 
 int tcp_socket_handle_async_sent(tx_msg_t *msg)
 {
-    virtqueue_ring_object_t handle;
-    msg->total_len = TCP_READ_SIZE;
-    msg->done_len = 0;
-    if (msg->socket_fd != tcp_echo_client) {
-        if (tcp_echo_client == -1) {
-            rx_buf_pool[num_rx_bufs] = msg;
-            num_rx_bufs++;
-            return 0;
-        } else {
-            msg->socket_fd = tcp_echo_client;
-        }
-
-    }
-    virtqueue_init_ring_object(&handle);
-    if (!virtqueue_add_available_buf(&rx_virtqueue, &handle, ENCODE_DMA_ADDRESS(msg), BUF_SIZE, VQ_RW)) {
-        ZF_LOGF("tcp_handle_sent: Error while enqueuing available buffer, queue full");
-    }
+    tcp_buf_t *buf = msg->client_cookie;
+    echo_stats.bytes_echoed += msg->total_len;
+    trace_record(TRACE_CLIENT_TX_DONE, msg->socket_fd, buf->trace_id);
+    tcp_buf_release(buf);
+    tcp_post_rx_bufs();
     return 0;
 
 }
 
-void handle_tcp_echo_notification(uint16_t events, int socket)
+static void tcp_accept(int socket)
 {
-    int ret = 0;
     char ip_string[16] = {0};
-
-    if (events & PICOSERVER_CONN) {
-        picoserver_peer_t peer = echo_control_accept(socket);
-        if (peer.result == -1) {
-            ZF_LOGF("Failed to accept a peer");
-        }
-        tcp_echo_client = peer.socket;
-        ret = echo_control_set_async(tcp_echo_client, true);
-        if (ret) {
-            ZF_LOGF("Failed to set a socket to async: %d!", ret);
-        }
-        while (num_rx_bufs > 0) {
-            virtqueue_ring_object_t handle;
-
-            virtqueue_init_ring_object(&handle);
-            num_rx_bufs--;
-            tx_msg_t *buf = rx_buf_pool[num_rx_bufs];
-            buf->total_len = TCP_READ_SIZE;
-            buf->done_len = 0;
-            buf->socket_fd = tcp_echo_client;
-
-            if (!virtqueue_add_available_buf(&rx_virtqueue, &handle, ENCODE_DMA_ADDRESS(buf), sizeof(*buf), VQ_RW)) {
-                ZF_LOGF("Error while enqueuing available buffer, queue full");
-            }
+    picoserver_peer_t peer = echo_control_accept(socket);
+    if (peer.result == -1) {
+        ZF_LOGF("Failed to accept a peer");
+    }
+    tcp_conn_t *conn = NULL;
+    for (int i = 0; i < MAX_TCP_CONNS; i++) {
+        if (!conns[i].open) {
+            conn = &conns[i];
+            break;
         }
+    }
+    if (conn == NULL || peer.socket < 0 || peer.socket >= MAX_SOCKET_FDS) {
+        ZF_LOGE("%s: Cannot take another connection, closing socket %d", get_instance_name(), peer.socket);
+        echo_control_close(peer.socket);
+        return;
+    }
+    int ret = echo_control_set_async(peer.socket, true);
+    if (ret) {
+        ZF_LOGF("Failed to set a socket to async: %d!", ret);
+    }
+    conn->socket = peer.socket;
+    conn->open = true;
+    num_open_conns++;
+    conn->gen++;
+    conn->bufs_lent = 0;
+    conn->packet_offset = 0;
+    conn_by_socket[peer.socket] = conn;
+    tcp_post_rx_bufs();
 
+    inet_ntop(AF_INET, &peer.peer_addr, ip_string, 16);
+    printf("%s: Connection established with %s on socket %d from socket %d\n", get_instance_name(), ip_string,
+           peer.socket, socket);
+}
 
-        inet_ntop(AF_INET, &peer.peer_addr, ip_string, 16);
-        printf("%s: Connection established with %s on socket %d from socket %d\n", get_instance_name(), ip_string,
-               tcp_echo_client, socket);
+void handle_tcp_echo_notification(uint16_t events, int socket)
+{
+    if (events & PICOSERVER_CONN) {
+        tcp_accept(socket);
     }
     if (events & PICOSERVER_CLOSE) {
-        ret = echo_control_shutdown(socket, PICOSERVER_SHUT_RDWR);
+        echo_control_shutdown(socket, PICOSERVER_SHUT_RDWR);
         printf("%s: Connection closing on socket %d\n", get_instance_name(), socket);
     }
     if (events & PICOSERVER_FIN) {
-        echo_control_close(tcp_echo_client);
-        tcp_echo_client = -1;
+        tcp_conn_t *conn = tcp_conn_lookup(socket);
+        if (conn != NULL) {
+            /* Buffers still lent to the connection go back to the pool as they complete */
+            conn->open = false;
+            num_open_conns--;
+            conn_by_socket[socket] = NULL;
+            /* The remaining connections each get a larger share */
+            tcp_post_rx_bufs();
+        }
+        echo_control_close(socket);
         printf("%s: Connection closed on socket %d\n", get_instance_name(), socket);
     }
     if (events & PICOSERVER_ERR) {
@@ -176,18 +270,19 @@ static int setup_tcp_echo_socket(ps_io_ops_t *io_ops)
         ZF_LOGF("Failed to bind a socket for listening!");
     }
 
-    ret = echo_control_listen(socket_in, 1);
+    ret = echo_control_listen(socket_in, MAX_TCP_CONNS);
     if (ret) {
         ZF_LOGF("Failed to listen for incoming connections!");
     }
 
     for (int i = 0; i < NUM_TCP_BUFS; i++) {
-        tx_msg_t *buf = ps_dma_alloc(&io_ops->dma_manager, BUF_SIZE, 4, 1, PS_MEM_NORMAL);
-        ZF_LOGF_IF(buf == NULL, "Failed to alloc");
-        memset(buf, 0, BUF_SIZE);
-        buf->socket_fd = -1;
-        buf->client_cookie = (void *)TCP_SOCKETS_ASYNC_ID;
-        rx_buf_pool[num_rx_bufs] = buf;
+        tx_msg_t *msg = ps_dma_alloc(&io_ops->dma_manager, BUF_SIZE, 4, 1, PS_MEM_NORMAL);
+        ZF_LOGF_IF(msg == NULL, "Failed to alloc");
+        memset(msg, 0, BUF_SIZE);
+        msg->socket_fd = -1;
+        msg->client_cookie = &tcp_bufs[i];
+        tcp_bufs[i].msg = msg;
+        rx_buf_pool[num_rx_bufs] = &tcp_bufs[i];
         num_rx_bufs++;
 
     }
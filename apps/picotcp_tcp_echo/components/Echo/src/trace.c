@@ -0,0 +1,73 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "trace.h"
+#include "tuning_params.h"
+
+#if ECHO_TRACE
+
+#include <camkes.h>
+#include <sel4bench/sel4bench.h>
+
+typedef struct trace_record {
+    uint64_t cycles;
+    uint64_t packet_id;
+    int32_t socket;
+    uint32_t point;
+} trace_record_t;
+
+static const char *point_names[TRACE_NUM_POINTS] = {
+    [TRACE_CLIENT_RX] = "client_rx",
+    [TRACE_CLIENT_TX] = "client_tx",
+    [TRACE_CLIENT_TX_DONE] = "client_tx_done",
+};
+
+/* Free running index of the next record to write */
+static uint64_t trace_head;
+static trace_record_t trace_buf[TRACE_BUF_LEN];
+
+void trace_record(trace_point_t point, int socket, uint64_t packet_id)
+{
+    if (packet_id == TRACE_NO_ID) {
+        return;
+    }
+    trace_record_t *record = &trace_buf[trace_head % TRACE_BUF_LEN];
+    record->cycles = (uint64_t)sel4bench_get_cycle_count();
+    record->packet_id = packet_id;
+    record->socket = socket;
+    record->point = point;
+    trace_head++;
+}
+
+void trace_dump(void)
+{
+    uint64_t first = trace_head > TRACE_BUF_LEN ? trace_head - TRACE_BUF_LEN : 0;
+    printf("trace_begin,%"PRIu64",%"PRIu64"\n", trace_head - first, first);
+    for (uint64_t i = first; i < trace_head; i++) {
+        trace_record_t *record = &trace_buf[i % TRACE_BUF_LEN];
+        printf("trace,%s,%d,%"PRIu64",%"PRIu64"\n", point_names[record->point], record->socket,
+               record->packet_id, record->cycles);
+    }
+    printf("trace_end\n");
+}
+
+void trace_reset(void)
+{
+    trace_head = 0;
+}
+
+static int setup_trace(UNUSED ps_io_ops_t *io_ops)
+{
+    sel4bench_init();
+    return 0;
+}
+
+CAMKES_POST_INIT_MODULE_DEFINE(setup_trace_, setup_trace);
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Timestamps of echoed packets, enabled with the PICOTCP_ECHO_TRACE CMake
+ * option.
+ *
+ * Each traced point appends a record of the cycle counter, socket and packet
+ * ID to a ring buffer owned by this component. Only this component's thread
+ * writes to it, so recording is a few stores with no locking. The oldest
+ * records are overwritten when the ring wraps.
+ *
+ * trace_dump prints every record as a "trace,point,socket,packet_id,cycles"
+ * line, which tools/trace_latency.py turns into per-hop latency
+ * distributions.
+ */
+
+/* Points in the pipeline that are traced, in the order a packet passes them */
+typedef enum {
+    /* Echo got the received data back from the picoserver */
+    TRACE_CLIENT_RX,
+    /* Echo handed the data to the picoserver to send */
+    TRACE_CLIENT_TX,
+    /* The picoserver returned the buffer after sending */
+    TRACE_CLIENT_TX_DONE,
+    TRACE_NUM_POINTS,
+} trace_point_t;
+
+/* Packet ID used when a buffer doesn't hold the start of a packet */
+#define TRACE_NO_ID UINT64_MAX
+
+#if ECHO_TRACE
+
+void trace_record(trace_point_t point, int socket, uint64_t packet_id);
+void trace_dump(void);
+void trace_reset(void);
+
+#else
+
+static inline void trace_record(trace_point_t point, int socket, uint64_t packet_id) {}
+static inline void trace_dump(void) {}
+static inline void trace_reset(void) {}
+
+#endif
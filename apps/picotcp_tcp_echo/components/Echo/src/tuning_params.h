@@ -8,6 +8,12 @@
 #define NUM_UDP_BUFS 510
 #define NUM_TCP_BUFS 510
 
+/* Maximum connected TCP echo clients */
+#define MAX_TCP_CONNS 16
+
+/* Socket numbers handed out by the picoserver are below this */
+#define MAX_SOCKET_FDS 256
+
 
 /* Size of initial TCP socket reads */
 #define TCP_READ_SIZE 1400
@@ -23,3 +29,19 @@
 #define PICOTCP_SOCKET_ASYNC_QUEUE_LEN 1024
 #define PICOTCP_SOCKET_ASYNC_POOL_SIZE (BUF_SIZE * PICOTCP_SOCKET_ASYNC_QUEUE_LEN)
 #define PICOSERVER_HEAP_SIZE 0x800000
+
+/* Records kept in the trace buffer when PICOTCP_ECHO_TRACE is enabled */
+#define TRACE_BUF_LEN 0x8000
+
+/* Scheduling context reservations, in microseconds, used when PICOTCP_ECHO_MCS
+ * is enabled. The stack's budgets add up to 60% of each period, which leaves
+ * the tenant at least its own 40%. */
+#define RESERVATION_PERIOD_US 10000
+#define ETHDRIVER_BUDGET_US 2000
+#define PICOSERVER_BUDGET_US 3000
+#define ECHO_BUDGET_US 1000
+#define TENANT_BUDGET_US 4000
+
+/* Gap in the cycle counter while Echo is handling an event that is counted as
+ * an overrun, see reservation.h */
+#define RESERVATION_GAP_CYCLES 100000
@@ -12,12 +12,10 @@ int udp_socket;
 
 int udp_socket_handle_async_received(tx_msg_t *msg)
 {
-    virtqueue_ring_object_t handle;
     if (msg->done_len == -1 || msg->done_len == 0) {
         msg->total_len = UDP_READ_SIZE;
         msg->done_len = 0;
-        virtqueue_init_ring_object(&handle);
-        if (!virtqueue_add_available_buf(&rx_virtqueue, &handle, ENCODE_DMA_ADDRESS(msg), BUF_SIZE, VQ_RW)) {
+        if (!echo_enqueue_buf(&rx_virtqueue, msg, BUF_SIZE)) {
             ZF_LOGF("udp_handle_received: Error while enqueuing available buffer, queue full");
         }
 
@@ -26,8 +24,7 @@ int udp_socket_handle_async_received(tx_msg_t *msg)
         msg->done_len = 0;
         /* copy the packet over */
 
-        virtqueue_init_ring_object(&handle);
-        if (!virtqueue_add_available_buf(&tx_virtqueue, &handle, ENCODE_DMA_ADDRESS(msg), sizeof(*msg), VQ_RW)) {
+        if (!echo_enqueue_buf(&tx_virtqueue, msg, sizeof(*msg))) {
             ZF_LOGF("udp_handle_received: Error while enqueuing available buffer, queue full");
         }
 
@@ -39,11 +36,10 @@ int udp_socket_handle_async_received(tx_msg_t *msg)
 
 int udp_socket_handle_async_sent(tx_msg_t *msg)
 {
-    virtqueue_ring_object_t handle;
+    echo_stats.bytes_echoed += msg->total_len;
     msg->total_len = UDP_READ_SIZE;
     msg->done_len = 0;
-    virtqueue_init_ring_object(&handle);
-    if (!virtqueue_add_available_buf(&rx_virtqueue, &handle, ENCODE_DMA_ADDRESS(msg), BUF_SIZE, VQ_RW)) {
+    if (!echo_enqueue_buf(&rx_virtqueue, msg, BUF_SIZE)) {
         ZF_LOGF("udp_handle_sent: Error while enqueuing available buffer, queue full");
     }
     return 0;
@@ -74,11 +70,7 @@ static int setup_udp_echo_socket(ps_io_ops_t *io_ops)
         buf->socket_fd = udp_socket;
         buf->client_cookie = (void *)UDP_SOCKETS_ASYNC_ID;
 
-        virtqueue_ring_object_t handle;
-
-        virtqueue_init_ring_object(&handle);
-
-        if (!virtqueue_add_available_buf(&rx_virtqueue, &handle, ENCODE_DMA_ADDRESS(buf), sizeof(*buf), VQ_RW)) {
+        if (!echo_enqueue_buf(&rx_virtqueue, buf, sizeof(*buf))) {
             ZF_LOGF("Error while enqueuing available buffer, queue full");
         }
     }
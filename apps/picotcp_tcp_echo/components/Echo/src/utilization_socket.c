@@ -8,6 +8,8 @@
 #include <string.h>
 
 #include "client.h"
+#include "reservation.h"
+#include "trace.h"
 
 /* Benchmark utilization TCP handler */
 int utiliz_socket;
@@ -22,6 +24,7 @@ int peer_socket = -1;
 #define START "START\n"
 #define STOP "STOP\n"
 #define QUIT "QUIT\n"
+#define TRACE "TRACE\n"
 #define RESPONSE "220 VALID DATA (Data to follow)\n" \
                  "Content-length: %d\n" \
                  "%s\n"
@@ -63,10 +66,15 @@ void handle_tcp_utiliz_notification(uint16_t events, int socket)
             memcpy(echo_send_buf, OK, strlen(OK));
             echo_send_send(socket, strlen(OK), 0);
         } else if (msg_match(echo_recv_buf, START)) {
+            memset(&echo_stats, 0, sizeof(echo_stats));
+            trace_reset();
+            reservation_reset();
             idle_start();
         } else if (msg_match(echo_recv_buf, STOP)) {
             uint64_t total, kernel, idle;
             idle_stop(&total, &kernel, &idle);
+            reservation_report(echo_stats.bytes_echoed);
+            echo_stats_report();
             char *util_msg;
             int len = asprintf(&util_msg, IDLE_FORMAT, idle, total);
             if (len == -1) {
@@ -81,6 +89,13 @@ void handle_tcp_utiliz_notification(uint16_t events, int socket)
                 free(util_msg);
             }
             echo_control_shutdown(socket, PICOSERVER_SHUT_RDWR);
+        } else if (msg_match(echo_recv_buf, TRACE)) {
+            /* Printing the records takes a long time over serial, so this is
+             * asked for separately once the measurement has been collected.
+             * Reply first so the client isn't left waiting on the dump. */
+            memcpy(echo_send_buf, OK, strlen(OK));
+            echo_send_send(socket, strlen(OK), 0);
+            trace_dump();
         } else if (msg_match(echo_recv_buf, QUIT)) {
         } else {
             printf("Couldn't match message: %s\n", (char *)echo_recv_buf);
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <camkes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <sel4bench/sel4bench.h>
+
+/* A CPU-bound tenant sharing the network stack's core in the MCS
+ * configuration.
+ *
+ * It spins on the cycle counter like the mcs-scheduling example's tasks: a
+ * jump of more than MAGIC_CYCLES between two reads means it was preempted or
+ * out of budget. After every REPORT_PREEMPTIONS preemptions it prints the
+ * share of the core it got since the last report, which stays at or above its
+ * budget as long as the stack's reservations hold.
+ */
+
+#define REPORT_PREEMPTIONS 1000
+
+/* Threshold to detect that the thread was preempted, might need to be changed
+ * depending on the platform */
+#define MAGIC_CYCLES 500
+
+int run(void)
+{
+    sel4bench_init();
+
+    uint64_t prev = (uint64_t)sel4bench_get_cycle_count();
+    uint64_t start = prev;
+    uint64_t consumed = 0;
+    int preemptions = 0;
+
+    while (true) {
+        uint64_t ts = (uint64_t)sel4bench_get_cycle_count();
+        uint64_t diff = ts - prev;
+        if (diff < MAGIC_CYCLES) {
+            COMPILER_MEMORY_FENCE();
+            consumed += diff;
+            COMPILER_MEMORY_FENCE();
+        } else {
+            preemptions++;
+            if (preemptions == REPORT_PREEMPTIONS) {
+                printf("%s: CPU share %"PRIu64"%% over %d preemptions\n", get_instance_name(),
+                       consumed * 100 / (ts - start), preemptions);
+                start = ts;
+                consumed = 0;
+                preemptions = 0;
+            }
+        }
+        prev = ts;
+    }
+    return 0;
+}
@@ -20,6 +20,17 @@ if("${KernelArch}" STREQUAL "x86")
     set(KernelIOMMU ON CACHE BOOL "" FORCE)
 endif()
 
+set(PICOTCP_ECHO_MULTICORE OFF CACHE BOOL "Run the Ethdriver, PicoServer and Echo on separate cores")
+if(PICOTCP_ECHO_MULTICORE)
+    # One core for each stage of the pipeline
+    set(KernelMaxNumNodes 3 CACHE STRING "" FORCE)
+endif()
+
+set(PICOTCP_ECHO_MCS OFF CACHE BOOL "Give the network stack budget reservations next to a CPU-bound tenant")
+if(PICOTCP_ECHO_MCS)
+    set(KernelIsMCS ON CACHE BOOL "" FORCE)
+endif()
+
 set(LibEthdriverRXDescCount 256 CACHE STRING "" FORCE)
 set(LibEthdriverTXDescCount 512 CACHE STRING "" FORCE)
 set(CAmkESNoFPUByDefault ON CACHE BOOL "" FORCE)
@@ -0,0 +1,15 @@
+#
+# Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+"""
+Helpers shared by the benchmark scripts in this directory.
+"""
+
+
+def percentile(values, fraction):
+    """Returns the value that fraction of the sorted values fall below."""
+    index = min(len(values) - 1, int(len(values) * fraction))
+    return values[index]
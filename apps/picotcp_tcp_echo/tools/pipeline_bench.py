@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+#
+# Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+"""
+Compare the echo server's throughput and latency between configurations.
+
+"run" drives the TCP echo port with a number of connections that each keep a
+window of messages in flight, and appends the throughput and round trip time
+percentiles to a CSV file under a label. "compare" prints the results of each
+label side by side, relative to the first label in the file.
+
+Example:
+    ./pipeline_bench.py run 10.13.1.74 --label single --output results.csv
+    (rebuild with -DPICOTCP_ECHO_MULTICORE=ON and boot the new image)
+    ./pipeline_bench.py run 10.13.1.74 --label multicore --output results.csv
+    ./pipeline_bench.py compare results.csv
+"""
+
+import argparse
+import asyncio
+import csv
+import os
+import time
+
+from bench_util import percentile
+
+FIELDS = ['label', 'connections', 'size', 'window', 'mbps', 'echoes_per_s',
+          'rtt_p50_us', 'rtt_p99_us', 'rtt_max_us']
+
+
+async def echo_client(host, port, payload, window, deadline, rtts):
+    reader, writer = await asyncio.open_connection(host, port)
+    sent = []
+    try:
+        for _ in range(window):
+            sent.append(time.monotonic())
+            writer.write(payload)
+        while sent:
+            await writer.drain()
+            await reader.readexactly(len(payload))
+            now = time.monotonic()
+            rtts.append(now - sent.pop(0))
+            if now < deadline:
+                sent.append(now)
+                writer.write(payload)
+    finally:
+        writer.close()
+        await writer.wait_closed()
+
+
+async def run(args):
+    payload = bytes(args.size)
+    rtts = []
+    start = time.monotonic()
+    deadline = start + args.duration
+    await asyncio.gather(*[echo_client(args.host, args.port, payload, args.window, deadline, rtts)
+                           for _ in range(args.connections)])
+    elapsed = time.monotonic() - start
+    rtts.sort()
+    return {
+        'label': args.label,
+        'connections': args.connections,
+        'size': args.size,
+        'window': args.window,
+        'mbps': '%.1f' % (len(rtts) * args.size * 8 / elapsed / 1e6),
+        'echoes_per_s': '%.1f' % (len(rtts) / elapsed),
+        'rtt_p50_us': '%.1f' % (percentile(rtts, 0.5) * 1e6),
+        'rtt_p99_us': '%.1f' % (percentile(rtts, 0.99) * 1e6),
+        'rtt_max_us': '%.1f' % (rtts[-1] * 1e6),
+    }
+
+
+def cmd_run(args):
+    result = asyncio.run(run(args))
+    print(', '.join('%s %s' % (field, result[field]) for field in FIELDS))
+    if args.output:
+        new_file = not os.path.exists(args.output)
+        with open(args.output, 'a', newline='') as f:
+            writer = csv.DictWriter(f, fieldnames=FIELDS)
+            if new_file:
+                writer.writeheader()
+            writer.writerow(result)
+
+
+def cmd_compare(args):
+    with open(args.results, newline='') as f:
+        rows = list(csv.DictReader(f))
+    if not rows:
+        return
+    # Compare runs with the same load against the first label that ran it
+    baselines = {}
+    for row in rows:
+        key = (row['connections'], row['size'], row['window'])
+        base = baselines.setdefault(key, row)
+        print("%-12s %4s conns %6s B x%-3s %9s Mb/s (%5.2fx) p50 %9s us (%5.2fx) p99 %9s us (%5.2fx)" %
+              (row['label'], row['connections'], row['size'], row['window'],
+               row['mbps'], float(row['mbps']) / float(base['mbps']),
+               row['rtt_p50_us'], float(row['rtt_p50_us']) / float(base['rtt_p50_us']),
+               row['rtt_p99_us'], float(row['rtt_p99_us']) / float(base['rtt_p99_us'])))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    subparsers = parser.add_subparsers(dest='command')
+    subparsers.required = True
+
+    run_parser = subparsers.add_parser('run', help='measure the running image')
+    run_parser.add_argument('host', help='address of the echo server')
+    run_parser.add_argument('--port', type=int, default=1234, help='TCP echo port')
+    run_parser.add_argument('--label', default='run', help='name of the configuration under test')
+    run_parser.add_argument('--connections', type=int, default=4, help='concurrent connections')
+    run_parser.add_argument('--size', type=int, default=1400, help='bytes per message')
+    run_parser.add_argument('--window', type=int, default=8,
+                            help='messages each connection keeps in flight')
+    run_parser.add_argument('--duration', type=float, default=10, help='seconds to run for')
+    run_parser.add_argument('--output', help='CSV file to append the result to')
+    run_parser.set_defaults(func=cmd_run)
+
+    compare_parser = subparsers.add_parser('compare', help='compare saved results')
+    compare_parser.add_argument('results', help='CSV file written by run')
+    compare_parser.set_defaults(func=cmd_compare)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == '__main__':
+    main()
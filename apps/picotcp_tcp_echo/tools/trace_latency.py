@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+#
+# Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+
+"""
+Turn packet timestamps dumped by the Echo component into per-hop latencies.
+
+Reads a console log containing "trace,point,socket,packet_id,cycles" lines,
+matches up the records of each packet and reports the latency distribution
+between each pair of consecutive points a packet passed through.
+
+With --request, instead asks the Echo component to print its records to its
+console by sending TRACE to the utilization endpoint. Do this once the
+measurement has finished, and capture the console to get the log.
+"""
+
+import argparse
+import collections
+import socket
+import sys
+
+from bench_util import percentile
+
+
+def request_dump(host, port):
+    """Asks the utilization endpoint to print the trace records. Returns
+    whether the request was accepted."""
+    with socket.create_connection((host, port)) as conn:
+        stream = conn.makefile('rw', newline='\n')
+        # Skip the "100 IPBENCH V1.0" greeting
+        stream.readline()
+        stream.write('TRACE\n')
+        stream.flush()
+        return stream.readline().startswith('200')
+
+
+def parse(lines):
+    """Returns the points in the order they were first seen, and the records
+    of each packet keyed by (socket, packet_id)."""
+    points = []
+    packets = collections.defaultdict(dict)
+    for line in lines:
+        fields = line.strip().split(',')
+        if len(fields) != 5 or fields[0] != 'trace':
+            continue
+        point, socket, packet_id, cycles = fields[1], int(fields[2]), int(fields[3]), int(fields[4])
+        if point not in points:
+            points.append(point)
+        # Packet IDs can repeat once the load generator wraps, keep the first sighting
+        packets[(socket, packet_id)].setdefault(point, cycles)
+    return points, packets
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('log', nargs='?', type=argparse.FileType('r'), default=sys.stdin,
+                        help='console log containing a trace dump')
+    parser.add_argument('--points', nargs='+',
+                        help='points to report on, in pipeline order (default: order seen in the log)')
+    parser.add_argument('--request', metavar='HOST',
+                        help='ask the Echo component at HOST to print its records to the console and exit')
+    parser.add_argument('--port', type=int, default=1236, help='utilization endpoint port')
+    args = parser.parse_args()
+
+    if args.request:
+        if not request_dump(args.request, args.port):
+            print("%s did not accept the TRACE request" % args.request)
+            return 1
+        print("Trace records are being printed to the console of %s" % args.request)
+        return 0
+
+    points, packets = parse(args.log)
+    if args.points:
+        points = args.points
+    if len(points) < 2:
+        print("Need records for at least two points, found: %s" % ', '.join(points))
+        return 1
+
+    for start, end in zip(points, points[1:]):
+        deltas = sorted(p[end] - p[start] for p in packets.values() if start in p and end in p)
+        if not deltas:
+            print("%s -> %s: no packets" % (start, end))
+            continue
+        print("%s -> %s: %d packets, p50 %d p99 %d p999 %d max %d cycles" %
+              (start, end, len(deltas), percentile(deltas, 0.5), percentile(deltas, 0.99),
+               percentile(deltas, 0.999), deltas[-1]))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -11,6 +11,11 @@
 #include <camkes/virtqueue.h>
 #include <utils/util.h>
 #include <string.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+/* Interval between throughput reports */
+#define REPORT_INTERVAL_NS NS_IN_S
 
 virtqueue_driver_t read_virtqueue;
 virtqueue_driver_t write_virtqueue;
@@ -18,48 +23,116 @@ virtqueue_driver_t write_virtqueue;
 void handle_read_callback(virtqueue_driver_t *vq);
 void handle_write_callback(virtqueue_driver_t *vq);
 
-void write_output(char *write_data, size_t write_data_size)
+/* Buffers taken from each virtqueue's shmem and not yet returned. Completed
+ * reads stay counted until their data has been moved to a write. */
+static int reads_in_flight;
+static int writes_in_flight;
+
+/* Bytes looped back since the last throughput report */
+static uint64_t report_start_ns;
+static uint64_t bytes_read;
+static uint64_t bytes_written;
+
+static void report_throughput(void)
 {
-    if (camkes_virtqueue_driver_scatter_send_buffer(&write_virtqueue, write_data, write_data_size)) {
-        ZF_LOGE("Client write enqueue failed");
+    uint64_t now = timeout_time();
+    uint64_t elapsed = now - report_start_ns;
+    if (elapsed < REPORT_INTERVAL_NS) {
         return;
     }
-    write_virtqueue.notify();
+    printf("loopback: read %"PRIu64" B/s, wrote %"PRIu64" B/s, %d reads and %d writes in flight\n",
+           bytes_read * NS_IN_S / elapsed, bytes_written * NS_IN_S / elapsed, reads_in_flight,
+           writes_in_flight);
+    report_start_ns = now;
+    bytes_read = 0;
+    bytes_written = 0;
 }
 
-void loopback_test(void)
+/* Return every buffer in a used chain to its virtqueue */
+static void free_buffer_chain(virtqueue_driver_t *vq, virtqueue_ring_object_t *handle)
 {
-    size_t buffer_size = 4000;
-
+    void *buf = NULL;
+    unsigned len = 0;
+    vq_flags_t flags;
+    while (camkes_virtqueue_driver_gather_buffer(vq, handle, &buf, &len, &flags) == 0) {
+        camkes_virtqueue_buffer_free(vq, buf);
+    }
+}
 
-    if (camkes_virtqueue_driver_scatter_send_buffer(&read_virtqueue, NULL, buffer_size)) {
-        ZF_LOGE("Client read enqueue failed");
-        return;
+/*
+ * Copy a completed read straight into a write buffer and send it. The read's
+ * buffers are returned to the read virtqueue whether or not the write could
+ * be sent, so a failure drops the data but doesn't leak shmem.
+ */
+static bool write_output(virtqueue_ring_object_t *read_handle, unsigned len)
+{
+    void *buf = NULL;
+    if (camkes_virtqueue_buffer_alloc(&write_virtqueue, &buf, len)) {
+        ZF_LOGE("Client write buffer allocation failed");
+        free_buffer_chain(&read_virtqueue, read_handle);
+        return false;
+    }
+    if (camkes_virtqueue_driver_gather_copy_buffer(&read_virtqueue, read_handle, buf, len) != 0) {
+        ZF_LOGE("Client read dequeue failed");
+        free_buffer_chain(&read_virtqueue, read_handle);
+        camkes_virtqueue_buffer_free(&write_virtqueue, buf);
+        return false;
+    }
+    bytes_read += len;
+    if (camkes_virtqueue_driver_send_buffer(&write_virtqueue, buf, len) != 0) {
+        ZF_LOGE("Client write enqueue failed");
+        camkes_virtqueue_buffer_free(&write_virtqueue, buf);
+        return false;
     }
+    writes_in_flight++;
+    return true;
+}
 
-    fflush(stdout);
-    read_virtqueue.notify();
+/*
+ * Keep up to loopback_depth reads and loopback_depth writes in flight. A
+ * completed read is only turned into a write while fewer than loopback_depth
+ * writes are in flight, otherwise it is left in the used ring until a write
+ * completes. Completed reads still count against the read depth, so a slow
+ * serial port throttles the reads.
+ */
+void loopback_test(void)
+{
+    bool posted = false;
+    while (reads_in_flight < loopback_depth) {
+        if (camkes_virtqueue_driver_scatter_send_buffer(&read_virtqueue, NULL, loopback_read_size)) {
+            ZF_LOGE("Client read enqueue failed");
+            break;
+        }
+        reads_in_flight++;
+        posted = true;
+    }
+    if (posted) {
+        fflush(stdout);
+        read_virtqueue.notify();
+    }
 }
 
-void handle_read_callback(virtqueue_driver_t *vq)
+/* Move completed reads to the write virtqueue while there is room for them */
+static void loopback_reads_to_writes(void)
 {
-    void *buf = NULL;
     unsigned len = 0;
     virtqueue_ring_object_t handle;
-    vq_flags_t flags;
+    bool sent = false;
 
-    if (!virtqueue_get_used_buf(vq, &handle, &len)) {
-        ZF_LOGE("Client virtqueue dequeue failed");
-        return;
+    while (writes_in_flight < loopback_depth && virtqueue_get_used_buf(&read_virtqueue, &handle, &len)) {
+        reads_in_flight--;
+        sent |= write_output(&handle, len);
     }
-    if (!(buf = calloc(len, sizeof(char)))) {
-        ZF_LOGE("Could not allocate memory");
-        return;
-    }
-    if (camkes_virtqueue_driver_gather_copy_buffer(vq, &handle, buf, len) != 0) {
-        free(buf);
+    if (sent) {
+        write_virtqueue.notify();
     }
-    write_output(buf, len);
+}
+
+void handle_read_callback(UNUSED virtqueue_driver_t *vq)
+{
+    loopback_reads_to_writes();
+    loopback_test();
+    report_throughput();
 }
 
 void handle_write_callback(virtqueue_driver_t *vq)
@@ -69,18 +142,19 @@ void handle_write_callback(virtqueue_driver_t *vq)
     virtqueue_ring_object_t handle;
     vq_flags_t flags;
 
-
-    if (!virtqueue_get_used_buf(vq, &handle, &len)) {
-        ZF_LOGE("Client virtqueue dequeue failed");
-        return;
-    }
-    while (camkes_virtqueue_driver_gather_buffer(vq, &handle, &buf, &len, &flags) == 0) {
-        /* Clean up and free the buffer we allocated */
-        camkes_virtqueue_buffer_free(vq, buf);
+    while (virtqueue_get_used_buf(vq, &handle, &len)) {
+        writes_in_flight--;
+        while (camkes_virtqueue_driver_gather_buffer(vq, &handle, &buf, &len, &flags) == 0) {
+            bytes_written += len;
+            /* Clean up and free the buffer we allocated */
+            camkes_virtqueue_buffer_free(vq, buf);
+        }
     }
-    /* Moving the call here forces synchronicity but makes it a bit slower */
-    /* TODO: make it more asynchronous */
+    /* Completed writes make room for reads that were held back, which in turn
+     * makes room for more reads */
+    loopback_reads_to_writes();
     loopback_test();
+    report_throughput();
 }
 
 /*
@@ -114,6 +188,29 @@ void pre_init(void)
     set_putchar(serial_putchar_putchar);
 }
 
+/* Check that loopback_depth buffers of loopback_read_size fit in a virtqueue's
+ * shared memory by allocating them all up front */
+static int check_vq_space(virtqueue_driver_t *vq, const char *name)
+{
+    void *bufs[loopback_depth];
+    int allocated = 0;
+    while (allocated < loopback_depth) {
+        if (camkes_virtqueue_buffer_alloc(vq, &bufs[allocated], loopback_read_size)) {
+            break;
+        }
+        allocated++;
+    }
+    for (int i = 0; i < allocated; i++) {
+        camkes_virtqueue_buffer_free(vq, bufs[i]);
+    }
+    if (allocated < loopback_depth) {
+        ZF_LOGE("Only %d of %d %d byte buffers fit in the %s virtqueue", allocated, loopback_depth,
+                loopback_read_size, name);
+        return -1;
+    }
+    return 0;
+}
+
 int run(void)
 {
     ZF_LOGE("Starting loopback serial test");
@@ -132,6 +229,15 @@ int run(void)
         return 1;
     }
 
+    if (loopback_depth < 1 || loopback_read_size < 1) {
+        ZF_LOGE("loopback_depth and loopback_read_size must be at least 1");
+        return 1;
+    }
+    if (check_vq_space(&read_virtqueue, "read") || check_vq_space(&write_virtqueue, "write")) {
+        return 1;
+    }
+
+    report_start_ns = timeout_time();
     loopback_test();
 
     return 0;
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <camkes.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <sel4bench/sel4bench.h>
+#include <spsc_ring.h>
+
+/* Microbenchmark for the SPSC ring used by picotcp_single_component.
+ *
+ * For each burst size the ring is repeatedly filled with a burst and drained
+ * again, and the number of objects moved through the ring is reported against
+ * the cycles it took. An op is one object enqueued and dequeued again.
+ */
+
+#define RING_SLOTS 256
+#define OPS_PER_BURST_SIZE 0x100000
+#define MAX_BURST 64
+
+SPSC_RING_DEFINE(ring, RING_SLOTS);
+
+static uintptr_t objs[MAX_BURST];
+
+int run(void)
+{
+    sel4bench_init();
+    spsc_ring_init(ring, RING_SLOTS);
+
+    for (int i = 0; i < MAX_BURST; i++) {
+        objs[i] = i;
+    }
+
+    for (uint32_t burst = 1; burst <= MAX_BURST; burst *= 2) {
+        uint64_t start = (uint64_t)sel4bench_get_cycle_count();
+        for (uint32_t done = 0; done < OPS_PER_BURST_SIZE; done += burst) {
+            if (spsc_ring_enqueue_burst(ring, objs, burst) != burst) {
+                ZF_LOGF("ring unexpectedly full");
+            }
+            COMPILER_MEMORY_FENCE();
+            if (spsc_ring_dequeue_burst(ring, objs, burst) != burst) {
+                ZF_LOGF("ring unexpectedly empty");
+            }
+        }
+        uint64_t cycles = (uint64_t)sel4bench_get_cycle_count() - start;
+        /* ops/cycle as fixed point with 3 decimal places */
+        uint64_t milli_ops_per_cycle = (OPS_PER_BURST_SIZE * 1000ull) / cycles;
+        printf("[%s] burst %2"PRIu32": %d ops, %"PRIu64" cycles, %"PRIu64".%03"PRIu64" ops/cycle\n",
+               get_instance_name(), burst, OPS_PER_BURST_SIZE, cycles, milli_ops_per_cycle / 1000,
+               milli_ops_per_cycle % 1000);
+    }
+    printf("[%s] done\n", get_instance_name());
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* MTU of the ethernet device. This can be set with the PICOTCP_MTU CMake
+ * variable, and the MTU used at run time can be lowered further with the
+ * component's mtu attribute. */
+#ifndef ETH_MTU
+#define ETH_MTU 1500
+#endif
+
+/* Ethernet header, VLAN tag and FCS on top of the MTU */
+#define ETH_FRAME_OVERHEAD 22
+
+/* Largest frame that can be sent or received */
+#define ETH_FRAME_MAX (ETH_MTU + ETH_FRAME_OVERHEAD)
+
+/* Number of buffers used for sending and receiving ethernet frames. */
+#define TX_BUFS 510
+#define RX_BUFS 510
+
+/* Completed TX buffers collected before they are returned to the pool */
+#define TX_RECLAIM_BATCH 32
+
+/* Slots in the rings used to queue buffers. Must be a power of two that is at
+ * least as large as RX_BUFS and TX_BUFS. */
+#define ETH_RING_SLOTS 512
+
+/* Size used for ethernet buffers, large enough for a whole frame */
+#if ETH_FRAME_MAX <= 2048
+#define BUF_SIZE 2048
+#elif ETH_FRAME_MAX <= 4096
+#define BUF_SIZE 4096
+#elif ETH_FRAME_MAX <= 8192
+#define BUF_SIZE 8192
+#elif ETH_FRAME_MAX <= 16384
+#define BUF_SIZE 16384
+#else
+#error "ETH_MTU is too large"
+#endif
+
+/* Hand RX buffers to picotcp without copying. The buffer is returned to the
+ * pool when picotcp releases the frame. */
+#define RX_ZERO_COPY 1
+
+/* Largest frame accepted when the driver scatters a frame over several buffers */
+#define RX_FRAME_MAX ETH_FRAME_MAX
+
+/* Number of clients that received frames can be classified to. This can be set
+ * with the PICOTCP_RX_CLIENTS CMake variable. With a single client the
+ * classifier is left out of the RX path. */
+#ifndef NUM_RX_CLIENTS
+#define NUM_RX_CLIENTS 1
+#endif
+
+/* Slots in the RX classification hash table, must be a power of two */
+#define RX_CLASSIFIER_SLOTS 64
+
+/* Default frames per event above which the driver switches to polling */
+#define POLL_MODE_THRESHOLD 32
+
+/* Default number of empty polls before going back to interrupts */
+#define POLL_MODE_IDLE_ROUNDS 128
+
+/* Maximum connected TCP clients */
+#define MAX_TCP_CLIENTS 4096
+
+/* Number of TCP clients' state allocated at a time */
+#define TCP_CLIENT_SLAB_CHUNK 64
+
+/* Default size of each TCP echo client's byte ring, must be a power of two */
+#define TCP_ECHO_RING_SIZE 0x2000
+
+/* Max size of UDP socket reads */
+#define UDP_READ_SIZE (ETH_MTU - 100)
+
+/* Number of UDP packets that can be queued for echoing, must be a power of two */
+#define UDP_BATCH_SIZE 64
+
+/* Default interval between samples in the utilization socket's streaming mode */
+#define UTILIZATION_STREAM_INTERVAL_MS 1000
+
+/* DMA memory to use for descriptor rings */
+#define DMA_RING_ALLOC_SIZE 0x4000
+
+/* Total DMA memory to allocate */
+#define DMA_ALLOC_SIZE (DMA_RING_ALLOC_SIZE + BUF_SIZE * (TX_BUFS + RX_BUFS))
+
+/* Default heap size, picotcp's socket state plus a default sized echo ring for
+ * each of MAX_TCP_CLIENTS clients. It can be changed with the component's
+ * heap_size attribute, and has to be raised along with tcp_echo_ring_size. */
+#define HEAP_SIZE (0x1000000 + MAX_TCP_CLIENTS * TCP_ECHO_RING_SIZE)
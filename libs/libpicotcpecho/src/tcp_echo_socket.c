@@ -0,0 +1,266 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <stdbool.h>
+
+#include <camkes.h>
+
+#undef PACKED
+#include <pico_stack.h>
+#include <pico_socket.h>
+#include <pico_ipv4.h>
+
+#include <ports.h>
+#include <tuning_params.h>
+
+
+/* This file implements a echo server that listens on a TCP port and returns
+ * every byte it receives in order. At most MAX_TCP_CLIENTS can be connected at
+ * a time. If clients disconnect, more can then connect.
+ *
+ * Per-client state is allocated from a slab when a client connects and is
+ * found again from the socket's priv pointer, so handling an event doesn't
+ * depend on the number of connected clients.
+ *
+ * Each client has a byte ring of tcp_echo_ring_size bytes. The server reads
+ * into whatever space is free in the ring and sends from the other end, so it
+ * keeps reading while earlier data is still waiting to be sent. Only when the
+ * ring is full does it stop reading, which leaves the data in picotcp and
+ * closes the receive window on the client.
+ */
+
+typedef struct tcp_client {
+    struct pico_socket *socket;
+    /* Whether sending is blocked until the next write event */
+    bool write_pending;
+    /* Free running indices into ring. Data is received at head and sent from tail. */
+    uint32_t ring_head;
+    uint32_t ring_tail;
+    /* tcp_echo_ring_size bytes of echo data */
+    char *ring;
+    /* Next free client in the slab */
+    struct tcp_client *next_free;
+} tcp_client_t;
+
+/* Socket global data */
+
+/* TCP socket listening for clients */
+static struct pico_socket *socket_in;
+
+/* Slab of client state. It grows by TCP_CLIENT_SLAB_CHUNK clients at a time
+ * up to MAX_TCP_CLIENTS, and freed clients are kept for reuse together with
+ * their rings. */
+static tcp_client_t *free_clients;
+static int num_clients_allocated;
+
+static tcp_client_t *client_alloc(void)
+{
+    if (free_clients == NULL) {
+        int chunk = MIN(TCP_CLIENT_SLAB_CHUNK, MAX_TCP_CLIENTS - num_clients_allocated);
+        if (chunk <= 0) {
+            return NULL;
+        }
+        tcp_client_t *clients = malloc(chunk * sizeof(*clients));
+        char *rings = malloc(chunk * tcp_echo_ring_size);
+        if (clients == NULL || rings == NULL) {
+            free(clients);
+            free(rings);
+            return NULL;
+        }
+        for (int i = 0; i < chunk; i++) {
+            clients[i].ring = rings + i * tcp_echo_ring_size;
+            clients[i].next_free = free_clients;
+            free_clients = &clients[i];
+        }
+        num_clients_allocated += chunk;
+    }
+    tcp_client_t *client = free_clients;
+    free_clients = client->next_free;
+    client->next_free = NULL;
+    client->write_pending = false;
+    client->ring_head = 0;
+    client->ring_tail = 0;
+    return client;
+}
+
+static void client_free(tcp_client_t *client)
+{
+    client->socket = NULL;
+    client->next_free = free_clients;
+    free_clients = client;
+}
+
+/* Send as much of the ring as picotcp will take */
+static void client_send(tcp_client_t *client)
+{
+    uint32_t mask = tcp_echo_ring_size - 1;
+    while (client->ring_head != client->ring_tail) {
+        uint32_t offset = client->ring_tail & mask;
+        uint32_t len = MIN(client->ring_head - client->ring_tail, tcp_echo_ring_size - offset);
+        int ret = pico_socket_send(client->socket, client->ring + offset, len);
+        if (ret == -1) {
+            /* Received socket error, report it and retry the rest of the
+             * ring on the next write event, or drop it when the socket closes */
+            ZF_LOGE("pico_socket_send: error received: %d", pico_err);
+            client->write_pending = true;
+            return;
+        }
+        if (ret == 0) {
+            /* Cannot send more data. Retry on the write-completed event */
+            client->write_pending = true;
+            break;
+        }
+        client->ring_tail += ret;
+    }
+    if (client->ring_head == client->ring_tail) {
+        client->write_pending = false;
+    }
+}
+
+/* Receive into the free space of the ring, sending as it fills */
+static void client_recv(tcp_client_t *client)
+{
+    uint32_t mask = tcp_echo_ring_size - 1;
+    while (client->ring_head - client->ring_tail < tcp_echo_ring_size) {
+        uint32_t offset = client->ring_head & mask;
+        uint32_t space = tcp_echo_ring_size - (client->ring_head - client->ring_tail);
+        uint32_t len = MIN(space, tcp_echo_ring_size - offset);
+        int ret = pico_socket_recv(client->socket, client->ring + offset, len);
+        if (ret == -1) {
+            /* Received socket error. Report and keep going. */
+            ZF_LOGE("pico_socket_recv: error received: %d", pico_err);
+            break;
+        } else if (ret == 0) {
+            /* No data available */
+            break;
+        }
+        client->ring_head += ret;
+        if (!client->write_pending) {
+            client_send(client);
+        }
+    }
+}
+
+
+/**
+ * @brief      picotcp socket callback function
+ *
+ * This function gets called when there are any socket events on the TCP
+ * socket or any sockets created from it. It isn't possible to register
+ * different handlers for the client sockets so this handler has to handle
+ * both connections and sends/receives.
+ *
+ * @param[in]  events  The picotcp events
+ * @param      s       Socket the event applies to.
+ */
+void handle_tcp_picoserver_notification(uint16_t events, struct pico_socket *s)
+{
+    int ret = 0;
+
+    /* The client state hangs off the socket. The listening socket has none. */
+    tcp_client_t *client = (s != socket_in) ? s->priv : NULL;
+
+    /* New client connected event */
+    if (events & PICO_SOCK_EV_CONN) {
+        uint32_t peer_addr;
+        uint16_t remote_port;
+        assert(client == NULL);
+        tcp_client_t *new_client = client_alloc();
+        if (new_client == NULL) {
+            /* Accept and close the connection rather than leaving it in the
+             * listen backlog, where the client would wait on it forever. Its
+             * remaining events arrive with no client state and are ignored. */
+            struct pico_socket *rejected = pico_socket_accept(socket_in, &peer_addr, &remote_port);
+            if (rejected != NULL) {
+                rejected->priv = NULL;
+                pico_socket_close(rejected);
+            }
+            printf("%s: Cannot connect new client, closing connection\n", get_instance_name());
+        } else {
+            /* Accept client connection */
+            new_client->socket = pico_socket_accept(socket_in, &peer_addr, &remote_port);
+            if (new_client->socket == NULL) {
+                ZF_LOGE("pico_socket_accept: error received: %d", pico_err);
+                client_free(new_client);
+            } else {
+                new_client->socket->priv = new_client;
+                char ip_string[16] = {0};
+                pico_ipv4_to_string(ip_string, peer_addr);
+                printf("%s: Connection established with %s on socket %p\n", get_instance_name(), ip_string,
+                       new_client->socket);
+            }
+        }
+    }
+    if (client == NULL) {
+        /* Remaining events are only for client sockets */
+        events &= ~(PICO_SOCK_EV_WR | PICO_SOCK_EV_RD | PICO_SOCK_EV_FIN);
+    }
+
+    /* Write successful event. If we have blocked writes try and resend */
+    if (events & PICO_SOCK_EV_WR && client->write_pending) {
+        bool was_full = client->ring_head - client->ring_tail == tcp_echo_ring_size;
+        client_send(client);
+        if (was_full) {
+            /* Set the Read event bit in order to pick up any reads that were
+             * left in picotcp while the ring was full.
+             */
+            events |= PICO_SOCK_EV_RD;
+        }
+    }
+
+    /* Read event on client socket. Receive into the ring and send what we can. */
+    if (events & PICO_SOCK_EV_RD) {
+        client_recv(client);
+    }
+
+    if (events & PICO_SOCK_EV_CLOSE) {
+        ret = pico_socket_shutdown(s, PICO_SHUT_RDWR);
+        printf("%s: Connection closing on socket %p\n", get_instance_name(), s);
+    }
+    if (events & PICO_SOCK_EV_FIN) {
+        s->priv = NULL;
+        client_free(client);
+        printf("%s: Connection closed on socket %p\n", get_instance_name(), s);
+    }
+    if (events & PICO_SOCK_EV_ERR) {
+        printf("%s: Error with socket %p, going to die\n", get_instance_name(), s);
+        assert(0);
+    }
+}
+
+
+int setup_tcp_socket(UNUSED ps_io_ops_t *io_ops)
+{
+    if (tcp_echo_ring_size <= 0 || (tcp_echo_ring_size & (tcp_echo_ring_size - 1)) != 0) {
+        ZF_LOGE("tcp_echo_ring_size must be a power of two, got %d", tcp_echo_ring_size);
+        return -1;
+    }
+
+    socket_in = pico_socket_open(PICO_PROTO_IPV4, PICO_PROTO_TCP, handle_tcp_picoserver_notification);
+    if (socket_in == NULL) {
+        ZF_LOGE("Failed to open a socket for listening!");
+        return -1;
+    }
+    uint32_t local_addr = PICO_IPV4_INADDR_ANY;
+    uint16_t port = short_be(TCP_ECHO_PORT);
+    int ret = pico_socket_bind(socket_in, &local_addr, &port);
+    if (ret) {
+        ZF_LOGE("Failed to bind a socket for listening: %d!", pico_err);
+        return -1;
+    } else {
+        printf("Bound to addr: %d, port %d\n", local_addr, port);
+    }
+
+    ret = pico_socket_listen(socket_in, MAX_TCP_CLIENTS);
+    if (ret) {
+        ZF_LOGE("Failed to listen for incoming connections!");
+        return -1;
+    }
+    return 0;
+}
+
+CAMKES_POST_INIT_MODULE_DEFINE(setup_tcp_socket_, setup_tcp_socket);
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#include <autoconf.h>
+#include <stdbool.h>
+
+#include <camkes.h>
+
+#undef PACKED
+#include <pico_stack.h>
+#include <pico_socket.h>
+#include <pico_ipv4.h>
+
+#include <ports.h>
+#include <tuning_params.h>
+
+/* This file implements a UDP echo server that responds to every UDP packet sent
+ * to it by replying with the same message to the sender. It communicates using
+ * a single socket.
+ *
+ * Received packets are queued in a ring of UDP_BATCH_SIZE buffers. Each event
+ * receives as many packets as there are free buffers and then sends the
+ * queued replies back-to-back, repeating until every pending packet has been
+ * received. If sending is blocked the replies stay queued and the server keeps
+ * receiving until every buffer is in use.
+ */
+
+typedef struct udp_reply {
+    /* Length of the packet */
+    int len;
+    /* Originating IPv4 address of the packet */
+    uint32_t orig;
+    /* Originating port of the packet */
+    uint16_t remote_port;
+    char data[UDP_READ_SIZE];
+} udp_reply_t;
+
+/* Ring of replies waiting to be sent. Free running indices, packets are
+ * received at head and sent from tail. */
+static udp_reply_t replies[UDP_BATCH_SIZE] ALIGN(0x1000);
+static uint32_t replies_head;
+static uint32_t replies_tail;
+
+/* How many received packet events are yet to be received. */
+static uint64_t rx_queued = 0;
+
+/* Send queued replies until the ring is empty or the socket is full.
+ * Returns false if sending is blocked until the next write event. */
+static bool udp_send_replies(struct pico_socket *s)
+{
+    while (replies_tail != replies_head) {
+        udp_reply_t *reply = &replies[replies_tail % UDP_BATCH_SIZE];
+        int ret = pico_socket_sendto(s, reply->data, reply->len, &reply->orig, reply->remote_port);
+        if (ret == 0) {
+            /* Socket is full, retry on the next write event */
+            return false;
+        }
+        if (ret == -1) {
+            /* Drop the packet rather than retrying it forever */
+            ZF_LOGE("pico_socket_sendto: Send received error: %d", pico_err);
+        }
+        replies_tail++;
+    }
+    return true;
+}
+
+/**
+ * @brief      picotcp socket callback function
+ *
+ * This callback is called whenever the UDP socket has an event. We either receive
+ * Read/Write/Error events.
+ *
+ * @param[in]  events  The events
+ * @param      s       socket that the events are received on.
+ */
+void handle_udp_picoserver_notification(uint16_t events, struct pico_socket *s)
+{
+    /* If a recieved event, add to the rx_queued amount */
+    if (events & PICO_SOCK_EV_RD) {
+        rx_queued++;
+        events &= ~PICO_SOCK_EV_RD;
+    }
+    if (events & PICO_SOCK_EV_ERR) {
+        printf("Error with socket %p\n", s);
+    }
+    /* Alternate between receiving into the free buffers and sending the batch
+     * back-to-back. Sending frees buffers for packets that didn't fit, so keep
+     * going until nothing is left to receive or sending blocks, in which case
+     * the next write event picks up from here. */
+    do {
+        while (rx_queued > 0 && replies_head - replies_tail < UDP_BATCH_SIZE) {
+            udp_reply_t *reply = &replies[replies_head % UDP_BATCH_SIZE];
+            int ret = pico_socket_recvfrom(s, reply->data, UDP_READ_SIZE, &reply->orig, &reply->remote_port);
+            rx_queued--;
+            if (ret == -1) {
+                ZF_LOGE("pico_socket_recvfrom: received error: %d\n", pico_err);
+                break;
+            } else if (ret == 0) {
+                ZF_LOGE("pico_socket_recvfrom: received empty message\n");
+                break;
+            }
+            reply->len = ret;
+            replies_head++;
+        }
+    } while (udp_send_replies(s) && rx_queued > 0);
+}
+
+
+int setup_udp_socket(UNUSED ps_io_ops_t *io_ops)
+{
+
+    struct pico_socket *udp_socket = pico_socket_open(PICO_PROTO_IPV4, PICO_PROTO_UDP, handle_udp_picoserver_notification);
+    if (udp_socket == NULL) {
+        ZF_LOGE("Failed to open a socket for listening!");
+        return -1;
+    }
+    uint32_t local_addr = PICO_IPV4_INADDR_ANY;
+    uint16_t udp_port = short_be(UDP_ECHO_PORT);
+    int ret = pico_socket_bind(udp_socket, &local_addr, &udp_port);
+    if (ret) {
+        ZF_LOGE("Failed to bind a socket for listening: %d!", pico_err);
+        return -1;
+    } else {
+        printf("Bound to addr: %d, port %d\n", local_addr, udp_port);
+    }
+
+    return 0;
+}
+
+CAMKES_POST_INIT_MODULE_DEFINE(setup_udp_socket_, setup_udp_socket);
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* Single producer, single consumer ring of uintptr_t sized slots.
+ *
+ * The ring is a fixed size control block followed by its slots, so it can be
+ * placed in static storage or in a dataport shared between two components.
+ * Slots hold plain integers, when the ring is shared between address spaces
+ * the slots should hold offsets rather than pointers.
+ *
+ * The producer only ever writes head and the consumer only ever writes tail,
+ * each lives on its own cache line together with a private copy of the other
+ * side's index so the shared line is only read when the ring looks full or
+ * empty. Indices run freely and are masked on access, so the number of slots
+ * must be a power of two.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <utils/util.h>
+
+#define SPSC_RING_CACHE_LINE 64
+
+typedef struct spsc_ring {
+    /* Written by the producer */
+    uint32_t head ALIGN(SPSC_RING_CACHE_LINE);
+    uint32_t producer_tail;
+    /* Written by the consumer */
+    uint32_t tail ALIGN(SPSC_RING_CACHE_LINE);
+    uint32_t consumer_head;
+    /* Constant after spsc_ring_init */
+    uint32_t mask ALIGN(SPSC_RING_CACHE_LINE);
+    uintptr_t slots[];
+} spsc_ring_t;
+
+/* Bytes of storage needed for a ring with num_slots slots */
+#define SPSC_RING_BYTES(num_slots) (sizeof(spsc_ring_t) + (num_slots) * sizeof(uintptr_t))
+
+/* Define static storage for a ring called name with num_slots slots */
+#define SPSC_RING_DEFINE(name, num_slots) \
+    static char name##_storage[SPSC_RING_BYTES(num_slots)] ALIGN(SPSC_RING_CACHE_LINE); \
+    static spsc_ring_t *const name = (spsc_ring_t *)name##_storage
+
+static inline void spsc_ring_init(spsc_ring_t *r, uint32_t num_slots)
+{
+    assert(num_slots > 0 && (num_slots & (num_slots - 1)) == 0);
+    r->head = 0;
+    r->producer_tail = 0;
+    r->tail = 0;
+    r->consumer_head = 0;
+    r->mask = num_slots - 1;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline uint32_t spsc_ring_capacity(spsc_ring_t *r)
+{
+    return r->mask + 1;
+}
+
+/* Number of used slots, as seen by the consumer */
+static inline uint32_t spsc_ring_count(spsc_ring_t *r)
+{
+    r->consumer_head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    return r->consumer_head - r->tail;
+}
+
+/* Number of free slots, as seen by the producer */
+static inline uint32_t spsc_ring_space(spsc_ring_t *r)
+{
+    r->producer_tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    return spsc_ring_capacity(r) - (r->head - r->producer_tail);
+}
+
+static inline bool spsc_ring_empty(spsc_ring_t *r)
+{
+    return r->consumer_head == r->tail && spsc_ring_count(r) == 0;
+}
+
+static inline bool spsc_ring_full(spsc_ring_t *r)
+{
+    return r->head - r->producer_tail == spsc_ring_capacity(r) && spsc_ring_space(r) == 0;
+}
+
+/**
+ * Enqueue up to n objects.
+ *
+ * @return number of objects enqueued, may be less than n if the ring fills up
+ */
+static inline uint32_t spsc_ring_enqueue_burst(spsc_ring_t *r, const uintptr_t *objs, uint32_t n)
+{
+    uint32_t head = r->head;
+    uint32_t space = spsc_ring_capacity(r) - (head - r->producer_tail);
+    if (space < n) {
+        space = spsc_ring_space(r);
+        if (space < n) {
+            n = space;
+        }
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        r->slots[(head + i) & r->mask] = objs[i];
+    }
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/**
+ * Dequeue up to n objects.
+ *
+ * @return number of objects dequeued, may be less than n if the ring empties
+ */
+static inline uint32_t spsc_ring_dequeue_burst(spsc_ring_t *r, uintptr_t *objs, uint32_t n)
+{
+    uint32_t tail = r->tail;
+    uint32_t count = r->consumer_head - tail;
+    if (count < n) {
+        count = spsc_ring_count(r);
+        if (count < n) {
+            n = count;
+        }
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        objs[i] = r->slots[(tail + i) & r->mask];
+    }
+    __atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/* Enqueue all n objects or none of them */
+static inline bool spsc_ring_enqueue_bulk(spsc_ring_t *r, const uintptr_t *objs, uint32_t n)
+{
+    if (spsc_ring_capacity(r) - (r->head - r->producer_tail) < n && spsc_ring_space(r) < n) {
+        return false;
+    }
+    return spsc_ring_enqueue_burst(r, objs, n) == n;
+}
+
+/* Dequeue all n objects or none of them */
+static inline bool spsc_ring_dequeue_bulk(spsc_ring_t *r, uintptr_t *objs, uint32_t n)
+{
+    if (r->consumer_head - r->tail < n && spsc_ring_count(r) < n) {
+        return false;
+    }
+    return spsc_ring_dequeue_burst(r, objs, n) == n;
+}
+
+static inline bool spsc_ring_enqueue(spsc_ring_t *r, uintptr_t obj)
+{
+    return spsc_ring_enqueue_burst(r, &obj, 1) == 1;
+}
+
+static inline bool spsc_ring_dequeue(spsc_ring_t *r, uintptr_t *obj)
+{
+    return spsc_ring_dequeue_burst(r, obj, 1) == 1;
+}
+
+/* Look at the oldest object without consuming it */
+static inline bool spsc_ring_peek(spsc_ring_t *r, uintptr_t *obj)
+{
+    if (spsc_ring_empty(r)) {
+        return false;
+    }
+    *obj = r->slots[r->tail & r->mask];
+    return true;
+}